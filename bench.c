@@ -0,0 +1,189 @@
+/* File: bench.c */
+/* Throughput of every conversion, on synthetic images of several sizes. Build it next to the CLI with "make bench"
+   and run "./bench [-s largest_side] [-r repeats] [-c cli]" */
+#include <stdio.h>                                                                                    /* Header file for standard I/O library */
+#include <string.h>                                           /* Header file which contains declarations of functions that operate on strings */
+#include <stdlib.h>                                                                           /* Header file for malloc() and the conversions */
+#include <time.h>                                                                                      /* Header file for the monotonic clock */
+#include <unistd.h>                                                                     /* Header file for fork(), exec() and temporary files */
+#include <fcntl.h>                                                                           /* Header file for redirecting output of the CLI */
+#include <sys/wait.h>                                                                                  /* Header file for waiting for the CLI */
+#include "netpbm.h"                                                                                   /* Header file of the library interface */
+#define CHUNK              65536                                                                  /* Size of the chunks fed to the stream API */
+
+typedef struct {                                                                                       /* A conversion of the dispatch tables */
+  int bonus;                                                                                                   /* The mode of the CLI, 0 or 1 */
+  char input, output;                                                                         /* The magic numbers of input and output images */
+} CONVERSION;
+
+typedef struct {                                                                                     /* Size of the images that are generated */
+  int width, height;
+} SIZE;
+
+static const CONVERSION conversions[] = {                                            /* The two dispatch tables of the CLI, in the same order */
+  {0, '2', '1'}, {0, '3', '2'}, {0, '5', '4'}, {0, '6', '5'},
+  {1, '1', '4'}, {1, '2', '5'}, {1, '3', '6'}, {1, '4', '1'}, {1, '5', '2'}, {1, '6', '3'}
+};
+static const SIZE sizes[] = {                                             /* From thumbnails to 20k x 20k, with odd widths for the P4 padding */
+  {64, 64}, {333, 227}, {1001, 777}, {4093, 4096}, {20000, 20000}
+};
+static unsigned int seed = 2463534242u;                                                /* State of the generator, so that runs are repeatable */
+
+unsigned char *generate(char magic, int width, int height, long *length);                                   /* Build a random image in memory */
+unsigned int next_random(void);                                                                                         /* Xorshift generator */
+double now(void);                                                                                                /* Monotonic time in seconds */
+double time_memory(const unsigned char *image, long length, int bonus, int repeats);                 /* Best time of the in-memory conversion */
+double time_stream(const unsigned char *image, long length, int bonus, int repeats);                    /* Best time of the stream conversion */
+double time_cli(const char *cli, const unsigned char *image, long length, int bonus, int repeats);          /* Best time of the CLI on a file */
+void discard(void *context, const unsigned char *bytes, long count);                                         /* Sink of the stream conversion */
+void report(const char *label, const char *path, double seconds, long length, long pixels);                             /* Print a throughput */
+
+
+int main(int argc, char *argv[]) {
+  int largest = 4096, repeats = 3, arg, i, j;
+  const char *cli = "./netpbm";
+  char label[64];
+  unsigned char *image;
+  long length, pixels;
+  for (arg = 1; arg < argc - 1; arg += 2) {
+    if (!strcmp(argv[arg], "-s")) largest = atoi(argv[arg + 1]);                               /* Up to 20000, for images of 20k x 20k pixels */
+    else if (!strcmp(argv[arg], "-r")) repeats = atoi(argv[arg + 1]);
+    else if (!strcmp(argv[arg], "-c")) cli = argv[arg + 1];
+    else break;
+  }
+  if (arg != argc || largest < 1 || repeats < 1) {
+    printf("Not supported option, try: \"./bench [-s largest_side] [-r repeats] [-c cli]\".\n");
+    return 1;
+  }
+  if (access(cli, X_OK) != 0) cli = NULL;                                                       /* Without the CLI, only the library is timed */
+  printf("%-8s %-8s %11s  %-6s %10s %10s\n", "mode", "images", "size", "path", "MB/s", "Mpixels/s");
+  for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+    if (sizes[i].width > largest || sizes[i].height > largest) continue;
+    pixels = (long) sizes[i].width * sizes[i].height;
+    for (j = 0; j < (int) (sizeof(conversions) / sizeof(conversions[0])); j++) {
+      image = generate(conversions[j].input, sizes[i].width, sizes[i].height, &length);
+      if (image == NULL) {
+        printf("Not enough memory for %dx%d images.\n", sizes[i].width, sizes[i].height);
+        return 1;
+      }
+      sprintf(label, "%-8s P%c -> P%c %5dx%-5d", conversions[j].bonus ? "bonus" : "standard", conversions[j].input, conversions[j].output,
+              sizes[i].width, sizes[i].height);
+      report(label, "memory", time_memory(image, length, conversions[j].bonus, repeats), length, pixels);
+      report(label, "stream", time_stream(image, length, conversions[j].bonus, repeats), length, pixels);
+      if (cli != NULL) report(label, "cli", time_cli(cli, image, length, conversions[j].bonus, repeats), length, pixels);
+      free(image);
+    }
+  }
+  return 0;
+}
+
+unsigned char *generate(char magic, int width, int height, long *length) {
+  long stride, room, i;
+  int h, w, sample, samples = (magic == '3' || magic == '6') ? 3 : 1;                                                /* Samples in each pixel */
+  unsigned char *image, *cursor;
+  stride = (magic == '4') ? (width + 7) / 8 : (long) samples * width;                                    /* Bytes of a line of a binary image */
+  room = (magic <= '3') ? 4 * (long) samples * width * height + height : stride * height;               /* ASCII samples take at most 4 bytes */
+  image = malloc(room + 32);
+  if (image == NULL) return NULL;
+  cursor = image + sprintf((char *) image, (magic == '1' || magic == '4') ? "P%c\n%d %d\n" : "P%c\n%d %d\n255\n", magic, width, height);
+  if (magic >= '4') {                                                                         /* Binary rasters take random bytes as they are */
+    for (i = 0; i < stride * height; i++) *cursor++ = next_random() >> 24;              /* The padding bits of P4 are random too, and ignored */
+  }
+  else {
+    for (h = 0; h < height; h++) {
+      for (w = 0; w < samples * width; w++) {
+        sample = (magic == '1') ? next_random() >> 31 : next_random() >> 24;
+        if (sample >= 100) *cursor++ = '0' + sample / 100;
+        if (sample >= 10) *cursor++ = '0' + sample / 10 % 10;
+        *cursor++ = '0' + sample % 10;
+        *cursor++ = ' ';
+      }
+      cursor[-1] = '\n';                                                                                             /* Every line ends alone */
+    }
+  }
+  *length = cursor - image;
+  return image;
+}
+
+unsigned int next_random(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+double now(void) {
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
+  return clock.tv_sec + clock.tv_nsec / 1e9;
+}
+
+double time_memory(const unsigned char *image, long length, int bonus, int repeats) {
+  long size = netpbm_output_size(image, length, bonus), used;
+  unsigned char *output = malloc(size);                                                                /* Allocated once, like a caller would */
+  double best = -1, start, elapsed;
+  if (output == NULL) return -1;
+  while (repeats-- > 0) {
+    used = size;
+    start = now();
+    if (netpbm_convert(image, length, output, &used, bonus) != NETPBM_OK) break;                                /* Generated images are valid */
+    elapsed = now() - start;
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+  free(output);
+  return best;
+}
+
+double time_stream(const unsigned char *image, long length, int bonus, int repeats) {
+  NETPBM_STREAM *stream;
+  double best = -1, start, elapsed;
+  long at;
+  while (repeats-- > 0) {
+    start = now();
+    stream = netpbm_stream_open(bonus, discard, NULL);
+    if (stream == NULL) break;
+    for (at = 0; at < length; at += CHUNK) netpbm_stream_feed(stream, image + at, (length - at < CHUNK) ? length - at : CHUNK);
+    if (netpbm_stream_close(stream) != NETPBM_OK) break;
+    elapsed = now() - start;
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+  return best;
+}
+
+double time_cli(const char *cli, const unsigned char *image, long length, int bonus, int repeats) {
+  char path[] = "/tmp/benchXXXXXX";
+  int fd = mkstemp(path), status;
+  long done, count;
+  double best = -1, start, elapsed;
+  pid_t child;
+  if (fd < 0) return -1;
+  for (done = 0; done < length && (count = write(fd, image + done, length - done)) > 0; done += count);
+  close(fd);
+  while (done == length && repeats-- > 0) {
+    start = now();
+    child = fork();
+    if (child == 0) {                                                                             /* The output of the CLI is timed, not kept */
+      fd = open("/dev/null", O_WRONLY);
+      dup2(fd, STDOUT_FILENO);
+      if (bonus) execl(cli, cli, "bonus", path, (char *) NULL);
+      else execl(cli, cli, path, (char *) NULL);
+      _exit(127);
+    }
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) break;
+    elapsed = now() - start;
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+  unlink(path);
+  return best;
+}
+
+void discard(void *context, const unsigned char *bytes, long count) {
+  (void) context;
+  (void) bytes;
+  (void) count;
+}
+
+void report(const char *label, const char *path, double seconds, long length, long pixels) {
+  if (seconds < 0) printf("%s  %-6s %10s %10s\n", label, path, "failed", "failed");
+  else printf("%s  %-6s %10.1f %10.1f\n", label, path, length / seconds / 1e6, pixels / seconds / 1e6);          /* Of input bytes and pixels */
+}
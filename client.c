@@ -0,0 +1,180 @@
+/* File: client.c */
+/* A client of the conversion server of the CLI, which is started with "./netpbm [options] --serve socket". Build it with
+   "make client" and run "./client [-t mode] [-r repeats] socket file ...", where mode is standard, bonus or one of
+   P1 to P7, PF or Pf. Every file is converted on one connection, and their outputs are written in order to the standard output, while the
+   stats of every request go to the standard error. With repeats, the files are sent again and again on the same connection, to time the server.
+   A request is a line "mode length" and the length bytes of the input. Its output comes back as lines "count" with count bytes each, and
+   ends with a line "0 status input output microseconds", where status is 0 for success or a NETPBM_ error of netpbm.h */
+#include <stdio.h>                                                                                    /* Header file for standard I/O library */
+#include <string.h>                                           /* Header file which contains declarations of functions that operate on strings */
+#include <stdlib.h>                                                                           /* Header file for malloc() and the conversions */
+#include <errno.h>                                                                       /* Header file for errno to detect interrupted calls */
+#include <time.h>                                                                                      /* Header file for the monotonic clock */
+#include <unistd.h>                                                                    /* Header file for the read() and write() system calls */
+#include <fcntl.h>                                                                                     /* Header file for opening input files */
+#include <sys/stat.h>                                                                                    /* Header file for the size of files */
+#include <sys/socket.h>                                                                       /* Header file for the connection to the server */
+#include <sys/un.h>                                                                   /* Header file for the addresses of Unix domain sockets */
+#include <pthread.h>                                                                    /* Header file for the thread that sends the requests */
+#define BLOCK              (1 << 17)                                                                   /* Size of the blocks of the responses */
+
+typedef struct {                                                                                             /* An input file and its request */
+  const char *path;
+  unsigned char *bytes;
+  long length;
+  char header[32];                                                                                                /* The line "mode length\n" */
+} REQUEST;
+
+typedef struct {                                                                                      /* The connection, read through a block */
+  int fd;
+  unsigned char *cursor, *end;
+  unsigned char data[BLOCK];
+} CONNECTION;
+
+unsigned char *load(const char *path, long *length);                                                           /* Read a whole file to memory */
+void *send_request(void *arg);                                                /* Send a request, while the response is read on another thread */
+int send_all(int fd, const void *bytes, long count);                                                            /* Write a whole block, or -1 */
+long receive(CONNECTION *connection);                                                   /* Number of bytes at hand, reading if there are none */
+int receive_line(CONNECTION *connection, char *line, int size);                                                          /* Get a line, or -1 */
+double now(void);                                                                                                /* Monotonic time in seconds */
+
+static int connection_fd = -1;                                                                                    /* The socket of the server */
+
+
+int main(int argc, char *argv[]) {
+  const char *mode = "standard";
+  int repeats = 1, arg = 1, round, i, files, status, failed = 0, requests = 0;
+  struct sockaddr_un address;
+  CONNECTION *connection;
+  REQUEST *request;
+  pthread_t sender;
+  char line[96];
+  long count, input, output, microseconds, part;
+  double start;
+  for (; arg < argc - 1 && argv[arg][0] == '-'; arg += 2) {
+    if (!strcmp(argv[arg], "-t")) mode = argv[arg + 1];
+    else if (!strcmp(argv[arg], "-r")) repeats = atoi(argv[arg + 1]);
+    else break;
+  }
+  files = argc - arg - 1;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (files < 1 || repeats < 1 || argv[arg][0] == '-' || strlen(argv[arg]) >= sizeof(address.sun_path)) {
+    printf("Not supported option, try: \"./client [-t mode] [-r repeats] socket file ...\".\n");
+    return 1;
+  }
+  strcpy(address.sun_path, argv[arg]);
+  connection = malloc(sizeof(CONNECTION));
+  request = calloc(files, sizeof(REQUEST));
+  if (connection == NULL || request == NULL) return 1;
+  for (i = 0; i < files; i++) {                                                               /* The files are read once, and sent repeatedly */
+    request[i].path = argv[arg + 1 + i];
+    request[i].bytes = load(request[i].path, &request[i].length);
+    if (request[i].bytes == NULL) {
+      fprintf(stderr, "Cannot open input file \"%s\".\n", request[i].path);
+      return 1;
+    }
+    sprintf(request[i].header, "%.15s %ld\n", mode, request[i].length);
+  }
+  connection->fd = connection_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection_fd < 0 || connect(connection_fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    fprintf(stderr, "Cannot connect to socket \"%s\".\n", argv[arg]);
+    return 1;
+  }
+  connection->cursor = connection->end = connection->data;
+  start = now();
+  for (round = 0; round < repeats; round++) {
+    for (i = 0; i < files; i++) {
+      if (pthread_create(&sender, NULL, send_request, &request[i]) != 0) return 1;      /* The server may answer before the input is all sent */
+      while (receive_line(connection, line, sizeof(line)) == 0 && (count = atol(line)) > 0) {              /* Chunks of output, until the end */
+        for (; count > 0; count -= part) {
+          part = receive(connection);
+          if (part == 0) break;
+          if (part > count) part = count;
+          if (round == 0) fwrite(connection->cursor, 1, part, stdout);                               /* The output of the repeats is the same */
+          connection->cursor += part;
+        }
+      }
+      pthread_join(sender, NULL);
+      if (sscanf(line, "%ld %d %ld %ld %ld", &count, &status, &input, &output, &microseconds) != 5) {
+        fprintf(stderr, "The server closed the connection.\n");
+        return 1;
+      }
+      fprintf(stderr, "%s: status %d, %ld bytes in, %ld bytes out, %ld us\n", request[i].path, status, input, output, microseconds);
+      if (status != 0) failed++;
+      requests++;
+    }
+  }
+  fprintf(stderr, "%d requests in %.3f s, %d failed.\n", requests, now() - start, failed);
+  fflush(stdout);
+  close(connection_fd);
+  return (failed > 0);
+}
+
+unsigned char *load(const char *path, long *length) {
+  struct stat info;
+  unsigned char *bytes;
+  long done, count;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &info) != 0 || (bytes = malloc(info.st_size + 1)) == NULL) {
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  for (done = 0; done < info.st_size && (count = read(fd, bytes + done, info.st_size - done)) > 0; done += count);
+  close(fd);
+  *length = done;
+  return bytes;
+}
+
+void *send_request(void *arg) {
+  REQUEST *request = arg;
+  if (send_all(connection_fd, request->header, strlen(request->header)) == 0) send_all(connection_fd, request->bytes, request->length);
+  return NULL;
+}
+
+int send_all(int fd, const void *bytes, long count) {
+  const unsigned char *cursor = bytes;
+  ssize_t written;
+  while (count > 0) {
+    written = send(fd, cursor, count, MSG_NOSIGNAL);                                        /* A server that is gone is noticed by the reader */
+    if (written < 0 && errno != EINTR) return -1;
+    if (written > 0) {
+      cursor += written;
+      count -= written;
+    }
+  }
+  return 0;
+}
+
+long receive(CONNECTION *connection) {
+  ssize_t count;
+  if (connection->cursor < connection->end) return connection->end - connection->cursor;
+  do {
+    count = read(connection->fd, connection->data, BLOCK);
+  } while (count < 0 && errno == EINTR);
+  if (count <= 0) return 0;                                                                    /* The server closed the connection, or failed */
+  connection->cursor = connection->data;
+  connection->end = connection->data + count;
+  return count;
+}
+
+int receive_line(CONNECTION *connection, char *line, int size) {
+  int length = 0;
+  while (receive(connection) > 0) {
+    if (*connection->cursor == '\n') {
+      connection->cursor++;
+      line[length] = '\0';
+      return 0;
+    }
+    if (length == size - 1) return -1;
+    line[length++] = *connection->cursor++;
+  }
+  line[0] = '\0';
+  return -1;
+}
+
+double now(void) {
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
+  return clock.tv_sec + clock.tv_nsec / 1e9;
+}
@@ -1,678 +1,4507 @@
-/* File: netpbm.c */
-#include <stdio.h>                                                                                    /* Header file for standard I/O library */
-#include <string.h>                                           /* Header file which contains declarations of functions that operate on strings */
-#define BnW_ASCII         '1'                                                                               /* Black and white image in ASCII */
-#define GRAY_ASCII        '2'                                                                                    /* Gray scale image in ASCII */
-#define COLOR_ASCII       '3'                                                                                     /* RGB color image in ASCII */
-#define BnW_BINARY        '4'                                                                              /* Black and white image in binary */
-#define GRAY_BINARY       '5'                                                                                   /* Gray scale image in binary */
-#define COLOR_BINARY      '6'                                                                                    /* RGB color image in binary */
-#define OK                 0                                                                                      /* Define a constant for OK */
-#define ERROR             -2                                                                    /* Define a constant for returning when ERROR */
-#define exit()             do {printf("Input error!\n"); return ERROR;} while(0)                   /* Termination in case of unexpected input */
-#define MAX_SIGNED_INT     ( ~ ( 1 << ( 8 * sizeof(int) - 1 ) ) )                 /* This is an integer with msb 0 and the rest of its bits 1 */
-
-
-
-int get_integer(int *pch);                                                                              /* Convert number in ASCII to integer */
-int white_space_or_comment(int *pch);                                                    /* Check for white space and skip potential comments */
-int white_space(int *pch);                                                                                           /* Check for white space */
-int single_white_character(int *pch);                                                                   /* Check for a single white character */
-int gray2bnw_ascii(int ch);                                                                             /* Convert gray image in ASCII to BnW */
-int color2gray_ascii (int ch);                                                                        /* Convert color image in ASCII to gray */
-int gray2bnw_binary (int ch);                                                                          /* Convert gray image in binary to BnW */
-int color2gray_binary(int ch);                                                                       /* Convert color image in binary to gray */
-int bnw_ascii2binary(int ch);                                                                         /* Convert BnW image in ASCII to binary */
-int gray_ascii2binary(int ch);                                                                       /* Convert gray image in ASCII to binary */
-int color_ascii2binary(int ch);                                                                     /* Convert color image in ASCII to binary */
-int bnw_binary2ascii(int ch);                                                                         /* Convert BnW image in binary to ASCII */
-int gray_binary2ascii(int ch);                                                                       /* Convert gray image in binary to ASCII */
-int color_binary2ascii(int ch);                                                                     /* Convert color image in binary to ASCII */
-
-
-int main(int argc, char *argv[]) {
-  if (argc == 1) {                                 /* Standard case: Convert color image(.ppm) to gray(.pgm) or gray image(.pgm) to BnW(.pbm) */
-    int ch;                                                                                 /* Declare ch as int because of getchar() and EOF */
-    ch = getchar();                                                                                                      /* Get the next byte */
-    if (ch == 'P') {                                                                            /* Every magic number should start with a 'P' */
-      putchar(ch);                                                                                        /* 'P' should be included in output */
-      ch = getchar();                                                                                                    /* Get the next byte */
-      switch (ch) {                                                                            /* Choose the conversion based on magic number */
-        case GRAY_ASCII:
-          return (gray2bnw_ascii(ch));                                                                                  /* Finish the program */
-        case COLOR_ASCII:
-          return (color2gray_ascii (ch));                                                                               /* Finish the program */
-        case GRAY_BINARY:
-          return (gray2bnw_binary (ch));                                                                                /* Finish the program */
-        case COLOR_BINARY:
-          return (color2gray_binary(ch));                                                                               /* Finish the program */
-        default:                                                                                     /* If none of the above cases, then exit */
-          exit();
-      }
-    }
-    else exit();
-  }
-  else if (argc == 2 && !strcmp(argv[1], "bonus")){                     /* Bonus case: Convert ASCII image to binary or binary image to ASCII */
-    int ch;                                                                                 /* Declare ch as int because of getchar() and EOF */
-    ch = getchar();                                                                                                      /* Get the next byte */
-    if (ch == 'P') {                                                                            /* Every magic number should start with a 'P' */
-      putchar(ch);                                                                                        /* 'P' should be included in output */
-      ch = getchar();                                                                                                    /* Get the next byte */
-      switch (ch) {                                                                            /* Choose the conversion based on magic number */
-        case BnW_ASCII:
-          return (bnw_ascii2binary(ch));                                                                                /* Finish the program */
-        case GRAY_ASCII:
-          return (gray_ascii2binary(ch));                                                                               /* Finish the program */
-        case COLOR_ASCII:
-          return (color_ascii2binary(ch));                                                                              /* Finish the program */
-        case BnW_BINARY:
-          return (bnw_binary2ascii(ch));                                                                                /* Finish the program */
-        case GRAY_BINARY:
-          return (gray_binary2ascii(ch));                                                                               /* Finish the program */
-        case COLOR_BINARY:
-          return (color_binary2ascii(ch));                                                                              /* Finish the program */
-        default:                                                                                     /* If none of the above cases, then exit */
-          exit();
-      }
-    }
-    else exit();
-  }
-  else {                                                                                                  /* Other case: Not supported option */
-    printf("Not supported option, try one of those: \"./netpbm\" or \"./netpbm bonus\".\n");
-    return ERROR;                                                                                                       /* Finish the program */
-  }
-}
-
-int gray2bnw_ascii(int ch) {                                                                            /* Convert gray image in ASCII to BnW */
-  int width, height, max, h, w, pixel;
-  putchar(ch - 1);                                                                /* Magic numbers are consecutive, so go to the previous one */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              if (white_space(&ch) == OK) {                                                                          /* Check for white space */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
-                    pixel = get_integer(&ch);                                                                          /* Current input pixel */
-                    if (pixel != ERROR && pixel <= max) {                                            /* Check if current input pixel is valid */
-                      pixel = (pixel > (max + 1) / 2) ? '0' : '1';                              /* Find the color of the current output pixel */
-                      putchar(pixel);
-                    }
-                    else exit();
-                    if (white_space(&ch) == OK) {                                                            /* Check if there is white space */
-                      putchar (' ');                                                   /* and put a space as the white space needed in output */
-                    }
-                    else if (w != width || h != height) {                                  /* Else check if the current pixel is the last one */
-                      exit();                                                                         /* and if not, exit with error notation */
-                    }
-                  }
-                  putchar('\n');                                                           /* Change line as the white space needed in output */
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int color2gray_ascii (int ch) {
-  int width, height, max, h, w, pixel, red, green, blue;
-  putchar(ch - 1);                                                                /* Magic numbers are consecutive, so go to the previous one */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              printf("%d", max);                                                                             /* Output image has the same max */
-              if (white_space(&ch) == OK) {                                                                          /* Check for white space */
-                putchar('\n');                                                             /* Change line as the white space needed in output */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
-                    red = get_integer(&ch);                                         /* The value of color red in current pixel of input image */
-                    if (red != ERROR && red <= max) {                                                       /* Check if value of red is valid */
-                      if (white_space(&ch) == OK) {                                                                  /* Check for white space */
-                        green = get_integer(&ch);                                 /* The value of color green in current pixel of input image */
-                        if (green != ERROR && green <= max) {                                             /* Check if value of green is valid */
-                          if (white_space(&ch) == OK) {                                                              /* Check for white space */
-                            blue = get_integer(&ch);                               /* The value of color blue in current pixel of input image */
-                            if (blue != ERROR && blue <= max) {                                            /* Check if value of blue is valid */
-                              pixel = (299 * red + 587 * green + 114 * blue) / 1000;            /* Find the color of the current output pixel
-                                                                                                                   based on luminosity method */
-                              printf("%d", pixel);                                                   /* Print the decimal equivalent of pixel */
-                              if (white_space(&ch) == OK) {                                                  /* Check if there is white space */
-                                putchar (' ');                                         /* and put a space as the white space needed in output */
-                              }
-                              else if (w != width || h != height) {                        /* Else check if the current pixel is the last one */
-                                exit();                                                               /* and if not, exit with error notation */
-                              }
-                            }
-                            else exit();
-                          }
-                          else exit();
-                        }
-                        else exit();
-                      }
-                      else exit();
-                    }
-                    else exit();
-                  }
-                  putchar('\n');                                                           /* Change line as the white space needed in output */
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int gray2bnw_binary (int ch) {
-  int width, height, max, h, w, pixels;
-  putchar(ch - 1);                                                                /* Magic numbers are consecutive, so go to the previous one */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              if (single_white_character(&ch) == OK) {                                                  /* Check for a single white character */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
-                    if (w%8 == 1) {                                                   /* Check if current output pixel is the first of a byte */
-                      pixels = 0xFF;                    /* If yes, then reset pixels to 11111111 (due to ace padding at the end of each line) */
-                    }
-                    if (ch > (max + 1) / 2 ) {                          /* Check if the color of the current output pixel should be white (0) */
-                      pixels &= ~(0x80 >> (w-1)%8);                                           /* If yes, then "clean" it by using an AND-mask */
-/* Note: By default when shifting force 0-fill, so by using (~) after (>>) the AND-mask is full of 1 except the bit that should get "cleaned" */
-                    }
-                    if (w%8 == 0 || w == width) {            /* Check if the current output pixel is the last of a byte or the last of a line */
-                      putchar(pixels);                                                                       /* If yes, then put current byte */
-                    }
-                    ch = getchar();                                                                                      /* Get the next byte */
-                    if (ch == EOF  && (w != width || h != height)) exit();           /* If EOF sooner than expected, exit with error notation */
-                  }
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int color2gray_binary(int ch) {
-  int width, height, max, h, w, pixel, red, green, blue;
-  putchar(ch - 1);                                                                /* Magic numbers are consecutive, so go to the previous one */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              printf("%d", max);                                                                             /* Output image has the same max */
-              if (single_white_character(&ch) == OK) {                                                  /* Check for a single white character */
-                putchar('\n');                                                             /* Change line as the white space needed in output */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
-                    if (ch <= max) {                                                 /* Check if the value for the first color (red) is valid */
-                      red = ch;
-                      ch = getchar();                                                                                    /* Get the next byte */
-                      if (ch == EOF) exit();                                         /* If EOF sooner than expected, exit with error notation */
-                      if (ch <= max) {                                              /* Check if the value for the next color (green) is valid */
-                        green = ch;
-                        ch = getchar();                                                                                  /* Get the next byte */
-                        if (ch == EOF) exit();                                       /* If EOF sooner than expected, exit with error notation */
-                        if (ch <= max) {                                             /* Check if the value for the last color (blue) is valid */
-                          blue = ch;
-                          ch = getchar();                                                                                /* Get the next byte */
-                          if (ch == EOF && (w != width || h != height)) exit();      /* If EOF sooner than expected, exit with error notation */
-                          pixel = (299 * red + 587 * green + 114 * blue) / 1000;                /* Find the color of the current output pixel
-                                                                                                                   based on luminosity method */
-                          putchar(pixel);
-                        }
-                        else exit();
-                      }
-                      else exit();
-                    }
-                    else exit();
-                  }
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int bnw_ascii2binary(int ch) {
-  int width, height, h, w, pixels;
-  putchar(ch + 3);                                  /* To convert the magic number of an image in ASCII to binarry, add 3 to the numeric part */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            for (h = 1; h <= height; h++) {                                                           /* h: current height from top to bottom */
-              for (w = 1; w <= width; w++) {                                                           /* w: current width from left to right */
-                if (w%8 == 1) {                                                       /* Check if current output pixel is the first of a byte */
-                  pixels = 0xFF;                        /* If yes, then reset pixels to 11111111 (due to ace padding at the end of each line) */
-                }
-                while (ch == '0') {                                                                   /* Skip the leading zeros of the number */
-                  ch = getchar();                                                                                        /* Get the next byte */
-                }
-                if (white_space(&ch) == OK) {   /* Check the first non-zero byte; if white space then the numeric value of current pixel is 0 */
-                  pixels &= ~(0x80 >> (w-1)%8);                                                       /* Then "clean" it by using an AND-mask */
-/* Note: By default when shifting force 0-fill, so by using (~) after (>>) the AND-mask is full of 1 except the bit that should get "cleaned" */
-                }
-                else if (ch == '1') {                       /* If the first non-zero byte is '1' then the numeric value of current pixel is 1 */
-                  ch = getchar();                                                                                        /* Get the next byte */
-                  if (white_space(&ch) != OK) {                                             /* Check if there is no white space after an '1', */
-                    if (ch != EOF || w != width || h != height) {                         /* but exclude the case of EOF after the last pixel */
-                      putchar(pixels);         /* In any other case of no white space, put the current byte (the unchecked bits will be aces) */
-                      exit();                                                                            /* and then exit with error notation */
-                    }
-                  }
-                }
-                else exit();                                    /* If after zeros there is no white space or an '1', exit with error notation */
-                if (w%8 == 0 || w == width) {                /* Check if the current output pixel is the last of a byte or the last of a line */
-                  putchar(pixels);                                                                          /* If yes, then put current pixel */
-                }
-              }
-            }
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int gray_ascii2binary(int ch) {
-  int width, height, max, h, w, pixel;
-  putchar(ch + 3);                                  /* To convert the magic number of an image in ASCII to binarry, add 3 to the numeric part */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              printf("%d", max);                                                                             /* Output image has the same max */
-              if (white_space(&ch) == OK) {                                                                          /* Check for white space */
-                putchar('\n');                                                             /* Change line as the white space needed in output */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w ++) {                                                      /* w: current width from left to right */
-                    pixel = get_integer(&ch);                                                                          /* Current input pixel */
-                    if (pixel != ERROR && pixel <= max) {                                            /* Check if current input pixel is valid */
-                      putchar(pixel);
-                      if (white_space(&ch) != OK) {                                                       /* Check if there is no white space */
-                        if (ch != EOF || w != width || h != height) {                     /* but exclude the case of EOF after the last pixel */
-                          exit();                                                                             /* and exit with error notation */
-                        }
-                      }
-                    }
-                    else exit();
-                  }
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int color_ascii2binary(int ch) {
-  int width, height, max, h, w, subpixel, color; //red, green, blue;
-  putchar(ch + 3);                                  /* To convert the magic number of an image in ASCII to binarry, add 3 to the numeric part */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              printf("%d", max);                                                                             /* Output image has the same max */
-              if (white_space(&ch) == OK) {                                                                          /* Check for white space */
-                putchar('\n');                                                             /* Change line as the white space needed in output */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
-                    for (color = 1; color <= 3; color ++) {                                          /* Each pixel consists of 3 colors (RGB) */
-                      subpixel = get_integer(&ch);                                                            /* Current subpixel value (RGB) */
-                      if (subpixel != ERROR && subpixel <= max) {                                         /* Check if subpixel value is valid */
-                        putchar(subpixel);
-                        if (white_space(&ch) != OK) {                                                     /* Check if there is no white space */
-                          if (ch != EOF || w != width || h != height) {                   /* but exclude the case of EOF after the last pixel */
-                            exit();                                                                           /* and exit with error notation */
-                          }
-                        }
-                      }
-                      else exit();
-                    }
-                  }
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int bnw_binary2ascii(int ch) {
-  int width, height, h, w, pixel;
-  putchar(ch - 3);                             /* To convert the magic number of an image in binarry to ASCII, subtract 3 by the numeric part */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (single_white_character(&ch) == OK) {                                                      /* Check for a single white character */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            for (h = 1; h <= height; h++) {                                                           /* h: current height from top to bottom */
-              for (w = 1; w <= width; w++) {                                                           /* w: current width from left to right */
-                pixel = ch;                                                                                               /* Save ch as pixel */
-                pixel &= 0x80;                                          /* Use AND-mask in orded to isolate the first bit and fill with zeros */
-                pixel = (pixel == 0x00) ? '0' : '1';                           /* If the first bit is 0 then current pixel is 0, else it is 1 */
-                putchar(pixel);
-                putchar(' ');                                                              /* Put a space as the white space needed in output */
-                ch <<= 1;                                                              /* Left shift ch by 1, so the next bit becomes the msb */
-                if (w % 8 == 0 || w == width) {              /* Check if the current output pixel is the last of a byte or the last of a line */
-                  ch = getchar();                                                                                        /* Get the next byte */
-                  if (ch == EOF && (w != width || h != height)) exit();              /* If EOF sooner than expected, exit with error notation */
-                }
-              }
-              putchar('\n');                                                               /* Change line as the white space needed in output */
-            }
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int gray_binary2ascii(int ch) {
-  int width, height, max, h, w;
-  putchar(ch - 3);                             /* To convert the magic number of an image in binarry to ASCII, subtract 3 by the numeric part */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              printf("%d", max);                                                                             /* Output image has the same max */
-              if (single_white_character(&ch) == OK) {                                                  /* Check for a single white character */
-                putchar('\n');                                                             /* Change line as the white space needed in output */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
-                    if (ch <= max) {                                                                       /* Check if current pixel is valid */
-                      printf("%d ", ch);                                                                /* Print the decimal equivalent of ch */
-                      ch = getchar();                                                                                    /* Get the next byte */
-                      if (ch == EOF && (w != width || h != height)) exit();          /* If EOF sooner than expected, exit with error notation */
-                    }
-                    else exit();
-                  }
-                  putchar('\n');                                                           /* Change line as the white space needed in output */
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int color_binary2ascii(int ch) {
-  int width, height, max, h, w, color;
-  putchar(ch - 3);                             /* To convert the magic number of an image in binarry to ASCII, subtract 3 by the numeric part */
-  ch = getchar();                                                                                                        /* Get the next byte */
-  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
-    putchar('\n');                                                                         /* Change line as the white space needed in output */
-    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
-    if (width != ERROR) {                                                                                          /* Check if width is valid */
-      printf("%d", width);                                                                                 /* Output image has the same width */
-      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
-        putchar(' ');                                                                  /* and put a space as the white space needed in output */
-        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
-        if (height != ERROR) {                                                                                    /* Check if height is valid */
-          printf("%d", height);                                                                           /* Output image has the same height */
-          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
-            putchar('\n');                                                                 /* Change line as the white space needed in output */
-            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
-            if (max != ERROR && max <= 255) {                                                                        /* Check if max is valid */
-              printf("%d", max);                                                                             /* Output image has the same max */
-              if (single_white_character(&ch) == OK) {                                                  /* Check for a single white character */
-                putchar('\n');                                                             /* Change line as the white space needed in output */
-                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
-                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
-                    for (color = 1; color <= 3; color ++) {                                          /* Each pixel consists of 3 colors (RGB) */
-                      if (ch <= max) {                                                    /* Check if the value of the current color is valid */
-                        printf("%d ", ch);                                                           /* Print the decimal equivalent of pixel */
-                        ch = getchar();                                                                                  /* Get the next byte */
-                        if (ch == EOF && (w != width || h != height)) exit();        /* If EOF sooner than expected, exit with error notation */
-                      }
-                      else exit();
-                    }
-                  }
-                  putchar('\n');                                                           /* Change line as the white space needed in output */
-                }
-              }
-              else exit();
-            }
-            else exit();
-          }
-          else exit();
-        }
-        else exit();
-      }
-      else exit();
-    }
-    else exit();
-  }
-  else exit();
-  return OK;
-}
-
-int get_integer(int *pch) {
-  int value;
-  if (*pch >= '0' && *pch <= '9') {
-    value = *pch - '0';                                                    /* Initialize the value as the numeric part of the ASCII character */
-    *pch = getchar();                                                                                                    /* Get the next byte */
-    while (*pch >= '0' && *pch <= '9') {                                           /* Repeat as long as the content of the pointer is numeric */
-      if (value > MAX_SIGNED_INT / 10) return ERROR;                              /* Check that "value" will not overflow if multiplied by 10 */
-      value = 10 * value + (*pch - '0');                                                                         /* Build one digit at a time */
-      *pch = getchar();                                                                                                  /* Get the next byte */
-    }
-  return value;                                                                                                          /* Successful finish */
- }
- else return ERROR;                                                                                                    /* Unsuccessful finish */
-}
-
-int white_space_or_comment(int *pch) {
-  if (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                            /* Check if there is a single white character */
-    *pch = getchar();                                                                                                    /* Get the next byte */
-    while (*pch == ' ' || *pch == '\t' || *pch == '\n' || *pch == '#') {    /* Skip every following white character or the potential comments */
-      if (*pch == '#') {                                                                                         /* Check if a comment begins */
-        while (*pch != '\n') {                                                           /* Skip every character as long as the comment lasts */
-          *pch = getchar();                                                                                              /* Get the next byte */
-        }
-      }
-      *pch = getchar();                                                                                                  /* Get the next byte */
-    }
-    return OK;                                                                                                           /* Successful finish */
-  }
-  else return ERROR;                                                                                                   /* Unsuccessful finish */
-}
-
-int white_space(int *pch) {
-  if (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                            /* Check if there is a single white character */
-    *pch = getchar();                                                                                                    /* Get the next byte */
-    while (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                             /* Skip every following white character */
-      *pch = getchar();                                                                                                  /* Get the next byte */
-    }
-    return OK;                                                                                                           /* Successful finish */
-  }
-  else return ERROR;                                                                                                   /* Unsuccessful finish */
-}
-
-int single_white_character(int *pch) {
-  if (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                            /* Check if there is a single white character */
-    *pch = getchar();                                                                                                    /* Get the next byte */
-    return OK;                                                                                                           /* Successful finish */
-  }
-  else return ERROR;                                                                                                   /* Unsuccessful finish */
-}
+/* File: netpbm.c */
+#include <stdio.h>                                                                                    /* Header file for standard I/O library */
+#include <string.h>                                           /* Header file which contains declarations of functions that operate on strings */
+#include <stdlib.h>                                                                       /* Header file for atexit() of the standard library */
+#include <errno.h>                                                                       /* Header file for errno to detect interrupted calls */
+#include <unistd.h>                                                                    /* Header file for the read() and write() system calls */
+#include <fcntl.h>                                                                                     /* Header file for opening input files */
+#include <sys/mman.h>                                                                        /* Header file for memory mapping of input files */
+#include <sys/stat.h>                                                                           /* Header file for the size and type of files */
+#include <pthread.h>                                                                    /* Header file for the threads that convert row bands */
+#include <dirent.h>                                                                 /* Header file for listing the input directory of a batch */
+#include <time.h>                                                                           /* Header file for the monotonic clock of --stats */
+#include <sys/socket.h>                                                                           /* Header file for the socket of the server */
+#include <sys/un.h>                                                                   /* Header file for the addresses of Unix domain sockets */
+#include <signal.h>                                                              /* Header file for ignoring SIGPIPE of clients that are gone */
+#include <sys/resource.h>                                                                       /* Header file for the peak memory of --stats */
+#include "netpbm.h"                                                                                   /* Header file of the library interface */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_KERNELS                                                                    /* Vectorized kernels are available for x86 processors */
+#include <immintrin.h>                                                                              /* Header file for SSE and AVX intrinsics */
+#endif
+#define BnW_ASCII         '1'                                                                               /* Black and white image in ASCII */
+#define GRAY_ASCII        '2'                                                                                    /* Gray scale image in ASCII */
+#define COLOR_ASCII       '3'                                                                                     /* RGB color image in ASCII */
+#define BnW_BINARY        '4'                                                                              /* Black and white image in binary */
+#define GRAY_BINARY       '5'                                                                                   /* Gray scale image in binary */
+#define COLOR_BINARY      '6'                                                                                    /* RGB color image in binary */
+#define PAM               '7'                                                   /* Image of tuples of any depth (PAM), such as RGB with alpha */
+#define PFM_COLOR         'F'                                                     /* RGB color image of floats (PFM), from the bottom line up */
+#define PFM_GRAY          'f'                                                                   /* Gray scale image of floats (PFM), likewise */
+#define depth(magic)       (((magic) - BnW_ASCII) % 3 + 1)                       /* 1 for BnW, 2 for gray and 3 for color, in either encoding */
+#define tupled(magic)      ((magic) == PAM || (magic) == PFM_COLOR || (magic) == PFM_GRAY)  /* Check if the chain converts a format as tuples */
+#define OK                 0                                                                                      /* Define a constant for OK */
+#define ERROR             -2                                                                    /* Define a constant for returning when ERROR */
+#define exit()             do {put_string("Input error!\n"); return ERROR;} while(0)               /* Termination in case of unexpected input */
+#define MAX_SIGNED_INT     ( ~ ( 1 << ( 8 * sizeof(int) - 1 ) ) )                 /* This is an integer with msb 0 and the rest of its bits 1 */
+#define MAX_VALUE          65535                                                      /* The largest max of an image, with samples of 2 bytes */
+#define READ_AHEAD         4                                         /* Blocks of input that may be read before they are parsed, if pipelined */
+#define BUFFER_SIZE        (1 << 17)                                       /* Size of the blocks in which input is read and output is written */
+#define get_byte()         (in.cursor < in.end ? *in.cursor++ : refill_input())           /* Get the next byte from the input buffer (or EOF) */
+#define unget_byte(c)      do {if ((c) != EOF) in.cursor--;} while(0)            /* Give back the last byte got, which is still in the buffer */
+#define WHITE              16                                                                   /* Class of white characters in token_class[] */
+#define is_digit(c)        (token_class[c] - 1u < 10)                                          /* Check if a buffered byte is a decimal digit */
+#define digit_value(c)     (token_class[c] - 1)                                                      /* The numeric value of a buffered digit */
+#define min(a, b)          ((a) < (b) ? (a) : (b))                                                              /* The smaller of two numbers */
+#define shrunk(n)          ((n) / scale + ((n) % scale != 0))                 /* Pixels of a side shrunk by -s, with a partial box at the end */
+/* Options that only the chain applies, which reshape images, change their samples or need all their pixels before any is put */
+#define transformed()      (scale > 1 || crop.width > 0 || dither == NETPBM_OTSU)
+#define ROW_CHUNK          4096                                                         /* Number of pixels handed to the row kernels at once */
+#define MAX_SCALE          256                            /* Largest factor of -s, so that the sum of a box of 2-byte samples fits in 32 bits */
+#define MAX_THREADS        256                                                                 /* Most threads that the -j option may ask for */
+#define STREAM_STACK       (1 << 19)                              /* Stack of the converter thread of a stream, with its thread-local buffers */
+#define BAND_BYTES         (1 << 18)                                             /* Number of input bytes in each band of rows of the -j mode */
+#define PENDING            0                                                                       /* State of a band that is being converted */
+#define DONE               1                                                                   /* State of a band that is ready to be written */
+#define FAILED             2                                                        /* State of a band with invalid samples or without memory */
+#define NO_INPUT          -3                                                           /* Status of a batch file whose input cannot be opened */
+#define NO_OUTPUT         -4                                                         /* Status of a batch file whose output cannot be created */
+#define CALLER_BUFFER     -2                                                         /* File descriptor of output into the buffer of a caller */
+#define STREAM            -3                                              /* File descriptor of input and output of the stream API, in chunks */
+#define FLOATS            -4                               /* File descriptor of the lines of a PFM raster in memory, as samples from the top */
+#define float_block(bytes) (((bytes) < BUFFER_SIZE) ? BUFFER_SIZE / (bytes) : 1)                  /* Lines of such a raster converted at once */
+#define CALLER             0                                                             /* Turn of a stream, when the caller of the API runs */
+#define CONVERTER          1                                                              /* Turn of a stream, when its converter thread runs */
+#define STARTING           0                                                                /* Phase of --stats before and between the images */
+#define PARSING_HEADER     1                                                                     /* Phase of --stats while a header is parsed */
+#define PARSING_RASTER     2                                                       /* Phase of --stats while the pixels are parsed one by one */
+#define RUNNING_KERNELS    3                                                      /* Phase of --stats while whole lines are converted at once */
+#define FLUSHING           4                                                                      /* Phase of --stats while output is written */
+#define PHASES             5
+#define enter_phase(p)     (stats_enabled ? switch_phase(p) : STARTING)               /* Enter a phase of --stats and return the previous one */
+#define start_raster(w, h) do {if (stats_enabled) raster_started(w, h);} while(0)                            /* The pixels of an image follow */
+#define HEADER_BYTES       64                                                 /* Most bytes of an output header, followed by "Input error!\n" */
+#define put_byte(c)        do {if (out.cursor == out.end) flush_output(); *out.cursor++ = (unsigned char) (c);} while(0)        /* Put a byte */
+#define put_sample(s, max) do {if ((max) > 255) put_byte((s) >> 8); put_byte(s);} while(0)                    /* Put a sample of 1 or 2 bytes */
+#define leveled(s)         ((levels.rescale != NULL) ? levels.rescale[s] : (s))          /* A sample at the max of output, by the table of -m */
+#define luma_level(sum)    ((2LL * (sum) * levels.last + 1000LL * levels.max) / (2000LL * levels.max))    /* The nearest sample to luma of -m */
+#define count_sample(s)    do {if (histogram.active) add_sample(s);} while(0)             /* Count the luminance of a pixel that is put alone */
+
+
+
+typedef struct {                                                                             /* Block buffer between a stream and the parsers */
+  unsigned char *cursor;                                                                /* Next byte to be read from or written to the buffer */
+  unsigned char *end;                                                         /* End of the valid input bytes or of the free space for output */
+  int fd;                 /* File descriptor of the underlying stream, or -1 for memory (mapped or growing), or CALLER_BUFFER for the library */
+  unsigned char *data;                                                                                       /* The buffered bytes themselves */
+  long size;                                                                                        /* Number of bytes that fit in the buffer */
+  int lost;                                                                  /* Check if output in memory was lost, because it could not grow */
+} BUFFER;
+
+typedef struct {                                                                         /* A band of rows, converted by a thread into memory */
+  BUFFER output;                                                                                           /* The converted bytes of the band */
+  int state;                                                                                                       /* PENDING, DONE or FAILED */
+} BAND;
+
+typedef struct {                                                          /* The lookup tables of -m and -l, for the max of the current image */
+  unsigned int *weights;              /* The red, green and blue parts of gray of each sample, in 2^24ths of white or in thousandths for luma */
+  unsigned short *encode;               /* The gray sample of each 65536th of white, for them, or of each sum of luma of bytes (else divided) */
+  unsigned short *rescale;                                                    /* The output sample of each input one, if only the max changes */
+  int max, last;                                                                       /* The max of the input samples and of the output ones */
+  int shift;                                                        /* The bits of a sum of parts below the index of encode: 8, or 0 for luma */
+} LEVELS;
+
+typedef struct {                                                  /* The statistics of the luminance of an image, for --histogram and -d otsu */
+  unsigned long count[4][256];                               /* Sub-histograms of 4 lanes, so that an update does not wait for the one before */
+  unsigned long long sum;                                      /* Of the samples, which is kept as they are counted only if they take 2 bytes */
+  int low, high;                                                                                /* The smallest and largest samples, likewise */
+  int width, height, max, bins;                                                   /* Samples of 2 bytes share 256 bins, else each has its own */
+  int active;                                                                                          /* Check if the pixels put are counted */
+} HISTOGRAM;
+
+typedef int ROW(const unsigned char *row, long count, int y, int max);      /* A row kernel: convert a whole line of a binary image, or ERROR */
+
+typedef struct {                                                             /* The raster of a binary image, split into bands of rows for -j */
+  int kind;                                                                                           /* The magic number of the output image */
+  ROW *put_row;                                                                                         /* The kernel that converts each line */
+  int width, height, max;
+  long stride;                                                                                          /* Number of bytes in each input line */
+  int size;                                                                                                 /* Number of bytes in each sample */
+  LEVELS levels;                                                                            /* The tables of -m and -l, shared by the threads */
+  HISTOGRAM *histogram;                                                           /* The statistics of the image, that every band is added to */
+  const unsigned char *raster;                                                                            /* The first byte of the first line */
+  int rows, count;                                                                               /* Number of lines in each band and of bands */
+  int next, written;                                                          /* The next band to be converted and the number of written ones */
+  BAND slot[2 * MAX_THREADS];                                           /* Bands in flight: the output queue lets threads run ahead of output */
+  pthread_mutex_t lock;                                                                               /* Guards next, written and every state */
+  pthread_cond_t changed;                                                                       /* Signaled whenever one of the above changes */
+} BANDS;
+
+typedef struct {                                                                                         /* An image to be converted in batch */
+  char *input, *output;                                                                                /* The paths of input and output files */
+  int status;                                                                                             /* OK, ERROR, NO_INPUT or NO_OUTPUT */
+} JOB;
+
+typedef struct {                                                 /* Jobs of a worker: it takes them from the head, others steal from the tail */
+  int head, tail;
+  pthread_mutex_t lock;
+} QUEUE;
+
+typedef struct {                                                                                   /* The images of a batch and their workers */
+  JOB *job;
+  char *text;                                                   /* The list file that holds the paths, or NULL if each input path has a block */
+  int count, bonus, workers;                                                                  /* Number of images, mode and number of workers */
+  QUEUE queue[MAX_THREADS];                                                                                        /* The jobs of each worker */
+} BATCH;
+
+typedef struct {                                                                                             /* A thread that converts images */
+  BATCH *batch;
+  int id;                                                                                                  /* The index of its queue in batch */
+  pthread_t thread;
+} WORKER;
+
+typedef struct {                                                                 /* A client of the server (--serve), whose requests are read */
+  int fd;
+  unsigned char *cursor, *end;                                                                                    /* The bytes not yet parsed */
+  long output;                                                                                        /* Number of bytes sent for the request */
+  unsigned char data[BUFFER_SIZE];
+} CONNECTION;
+
+typedef struct {                                                                 /* A thread that writes output blocks in pipelined mode (-p) */
+  unsigned char *block;                                                                         /* The block being written, or NULL when idle */
+  long count;                                                                                                 /* Number of bytes in the block */
+  int fd;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;                                                                                  /* Signaled whenever block changes */
+} WRITER;
+
+typedef struct {                                                             /* A thread that reads input blocks ahead in pipelined mode (-p) */
+  unsigned char *block[READ_AHEAD];                                                                       /* The ring of blocks, used in turn */
+  long count[READ_AHEAD];                                                             /* Number of bytes in each block, 0 at the end of input */
+  long taken, filled;                                    /* Blocks released by the parsers and filled by the reader, at most READ_AHEAD apart */
+  long size;                                                                                                        /* The size of the blocks */
+  int fd, held;                                                                                /* Check if the parsers are in the block taken */
+  pthread_mutex_t lock;
+  pthread_cond_t changed;                                                                     /* Signaled whenever a block is taken or filled */
+} READER;
+
+typedef struct {                                                                     /* The buffer of a library caller, that output goes into */
+  unsigned char *data;
+  long length, capacity;                                                                    /* Number of bytes put so far, and that fit in it */
+  unsigned char *staging;                                            /* Block of the last bytes, when the kernels need more room than is left */
+} TARGET;
+
+typedef struct {                                                                       /* Profile of --stats, kept by every converting thread */
+  double seconds[PHASES];                                                                                         /* Time spent in each phase */
+  double since;                                                                                         /* When the current phase was entered */
+  int phase;
+  long read, written, pixels;                                                                        /* Bytes of input and output, and pixels */
+} STATS;
+
+typedef struct {                                                  /* The state of Floyd-Steinberg dithering, one line at a time, or of Otsu's */
+  int *lines;                                                                                        /* The block of both lines, as allocated */
+  int *errors, *next;                                        /* Errors carried to the current and to the next line, in sixteenths of a sample */
+  int width, line;                                                                             /* line: the line that errors are carried into */
+  unsigned char *frame;                                   /* The gray lines of the image, kept for Otsu's method until its threshold is known */
+  long used, room;                                                                          /* Bytes of the lines kept, and that fit in frame */
+  int threshold;                                                                          /* Otsu's threshold, or -1 while the lines are kept */
+} DITHER;
+
+typedef struct {                                              /* The header of an image that is converted as tuples, of PAM, PFM or any other */
+  int width, height, max;                                                                                  /* PFM has floats instead of a max */
+  int depth;                                                          /* Samples in each tuple of the raster: of PAM as declared, else 1 or 3 */
+  int kind;    /* The format that its pixels are read as: P1 for the bytes of BnW PAM, P5 or P6 for the rest of PAM and for PFM, else its own */
+  int little;                                                                                 /* Check if the floats of PFM are little endian */
+} HEADER;
+
+typedef struct {                                                  /* PAM and PFM of the current image, which the chain converts like P1 to P6 */
+  int depth;                                                /* Samples in each tuple of a PAM input, of which the first 1 or 3 are kept, or 0 */
+  int output;                                                              /* The format of the output, if PAM, PFM_COLOR or PFM_GRAY, else 0 */
+  unsigned char *copy;                                              /* A line of tuples or floats, when it cannot be used in the input buffer */
+  unsigned char *samples;                                         /* The raster of a PFM input as samples, from the top line down, or a block */
+  const unsigned char *raster;                              /* of its lines, if its floats are all in memory and are converted block by block */
+  HEADER header;                                                                                           /* The header of PFM, with the max */
+  int lines;                                                                            /* Lines of the raster that are still to be converted */
+  unsigned char *floats;                                                              /* The lines of a PFM output, kept until the bottom one */
+  long used, room;                                                                         /* Bytes of the lines kept, and that fit in floats */
+} TUPLES;
+
+typedef struct {                                                  /* The boxes of a line shrunk by -s, summed while their source lines arrive */
+  unsigned int *sums;                                                                          /* One for each sample of a line of the output */
+  int width;                                                                                                   /* Output pixels that they fit */
+} SHRINK;
+
+typedef struct {                                                                                         /* A rectangle of pixels of an image */
+  int x, y;                                                                                                             /* Its top left pixel */
+  int width, height;                                                                                                 /* 0 for the whole image */
+} REGION;
+
+struct NETPBM_STREAM {                                                                 /* Images converted while they arrive, for the library */
+  int bonus, status;
+  int turn;                                                                  /* CALLER or CONVERTER: the two sides never run at the same time */
+  int ended, finished;                                                                    /* Check if the input and the conversion have ended */
+  const unsigned char *chunk;                                                                            /* The input handed to the converter */
+  long count;
+  const unsigned char *block;                                                                     /* The output handed to the caller, or NULL */
+  long length;
+  void (*sink)(void *, const unsigned char *, long);
+  void *context;
+  pthread_t thread;                                                                 /* The parser state lives on its stack between the chunks */
+  pthread_mutex_t lock;
+  pthread_cond_t changed;                                                                                   /* Signaled whenever turn changes */
+  unsigned char output[BUFFER_SIZE];
+};
+
+static unsigned char input_data[BUFFER_SIZE], output_data[BUFFER_SIZE];                            /* Blocks of the standard input and output */
+static _Thread_local BUFFER in = {input_data, input_data, STDIN_FILENO, input_data, BUFFER_SIZE, 0};                   /* Input buffer, empty */
+static _Thread_local BUFFER out = {output_data, output_data + BUFFER_SIZE, STDOUT_FILENO, output_data, BUFFER_SIZE, 0};      /* Output buffer */
+static _Thread_local long consumed = 0;                                                  /* Input bytes before the buffered ones, for --check */
+
+
+
+int open_input(const char *path);                                                         /* Open an input file instead of the standard input */
+int map_input(int fd);                                                                            /* Map an input file to memory, if possible */
+int refill_input(void);                                                             /* Read the next block of input and return its first byte */
+void flush_output(void);                                                                               /* Write all the buffered output bytes */
+void put_integer(int value);                                                                      /* Put the decimal equivalent of an integer */
+void put_string(const char *string);                                                                                          /* Put a string */
+int valid_samples(const unsigned char *samples, long count, int max);                                     /* Check that no sample exceeds max */
+ROW threshold_row, threshold_wide_row, dithered_row, luminosity_row, luminosity_checked_row, luminosity_wide_row, luminosity_wide_checked_row;
+ROW gray_decimals_row, gray_decimals_checked_row, gray_decimals_wide_row, gray_decimals_wide_checked_row, bits_ascii_row;
+ROW color_decimals_row, color_decimals_checked_row, color_decimals_wide_row, color_decimals_wide_checked_row;
+ROW weighed_row, weighed_checked_row, rescaled_gray_row, rescaled_gray_checked_row, rescaled_color_row, rescaled_color_checked_row;
+ROW *row_kernel(int kind, int max);                                               /* Choose the row kernel of an image, once its max is known */
+void put_packed(const unsigned char *samples, long count);                                      /* Put BnW pixels of 0 or 1 in binary, packed */
+void put_luminosity(const unsigned char *rgb, long count);                                     /* Put the gray pixels of RGB pixels in binary */
+void put_luminosity_ascii(const unsigned char *rgb, int count);                                 /* Put the gray pixels of RGB pixels in ASCII */
+void luminosity_scalar(const unsigned char *rgb, unsigned char *gray, int count);                           /* Luminosity one pixel at a time */
+void luminosity_dispatch(const unsigned char *rgb, unsigned char *gray, int count);          /* Choose the best luminosity kernel for the CPU */
+#ifdef X86_KERNELS
+void luminosity_ssse3(const unsigned char *rgb, unsigned char *gray, int count);                        /* Luminosity for 16 pixels at a time */
+void luminosity_avx2(const unsigned char *rgb, unsigned char *gray, int count);                         /* Luminosity for 32 pixels at a time */
+#endif
+void put_luminosity_wide(const unsigned char *rgb, long count);
+void luminosity_wide_scalar(const unsigned char *rgb, unsigned char *gray, int count);
+void luminosity_wide_dispatch(const unsigned char *rgb, unsigned char *gray, int count);
+#ifdef X86_KERNELS
+void luminosity_wide_sse41(const unsigned char *rgb, unsigned char *gray, int count);
+void luminosity_wide_avx2(const unsigned char *rgb, unsigned char *gray, int count);
+#endif
+void put_threshold(const unsigned char *gray, long count, int threshold);                      /* Put the BnW pixels of gray pixels in binary */
+void threshold_scalar(const unsigned char *gray, unsigned char *bits, int count, int threshold);    /* Threshold and pack one pixel at a time */
+void threshold_dispatch(const unsigned char *gray, unsigned char *bits, int count, int threshold);        /* Choose the best threshold kernel */
+#ifdef X86_KERNELS
+void threshold_sse2(const unsigned char *gray, unsigned char *bits, int count, int threshold);      /* Threshold and pack 16 pixels at a time */
+void threshold_avx2(const unsigned char *gray, unsigned char *bits, int count, int threshold);      /* Threshold and pack 32 pixels at a time */
+#endif
+void put_threshold_wide(const unsigned char *gray, long count, int threshold);
+void ordered_scalar(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits);   /* Bayer dithering and packing */
+void ordered_dispatch(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits);      /* Choose the best kernel */
+#ifdef X86_KERNELS
+void ordered_sse2(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits);         /* for 16 pixels at a time */
+void ordered_avx2(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits);         /* for 32 pixels at a time */
+#endif
+void drop_samples_scalar(const unsigned char *samples, unsigned char *pixels, int count, int stride, int kept);    /* Drop the rest of tuples */
+void drop_samples_dispatch(const unsigned char *samples, unsigned char *pixels, int count, int stride, int kept);   /* Choose the best kernel */
+#ifdef X86_KERNELS
+void drop_samples_ssse3(const unsigned char *samples, unsigned char *pixels, int count, int stride, int kept);   /* for many pixels at a time */
+#endif
+void float_samples_scalar(const unsigned char *floats, unsigned char *samples, long count, int max, int little);         /* Floats as samples */
+void float_samples_dispatch(const unsigned char *floats, unsigned char *samples, long count, int max, int little);
+#ifdef X86_KERNELS
+void float_samples_sse2(const unsigned char *floats, unsigned char *samples, long count, int max, int little);    /* for 16 samples at a time */
+#endif
+void sample_floats_scalar(const unsigned char *samples, unsigned char *floats, long count, int max);       /* Samples as little endian floats */
+void sample_floats_dispatch(const unsigned char *samples, unsigned char *floats, long count, int max);
+#ifdef X86_KERNELS
+void sample_floats_sse2(const unsigned char *samples, unsigned char *floats, long count, int max);                 /* for 8 samples at a time */
+#endif
+int start_dither(int width);                                                               /* Prepare the dithering of an image of that width */
+void end_dither(void);                                                                                     /* Free the state of the dithering */
+int dither_pixel(int value, int x, int y, int max);                                    /* Check if a gray pixel becomes white, with dithering */
+void dither_samples(const unsigned char *gray, unsigned char *white, int count, int x, int y, int max);       /* Whiten many pixels of a line */
+void put_dithered(const unsigned char *gray, long count, int y, int max);                 /* Put the BnW pixels of a line in binary, dithered */
+void keep_samples(const unsigned char *samples, long count);                   /* Keep gray samples of a line until Otsu's threshold is known */
+int put_otsu(int target, int width, int height, int max);                                  /* Put the lines kept, once the threshold is known */
+void start_histogram(int width, int height, int max, int active);                 /* Count the luminance of the pixels of an image, if active */
+void count_pixels(const unsigned char *pixels, int magic, int target, int count, int wide);                     /* Count pixels of any format */
+void add_histogram(const unsigned char *samples, int count, int wide);                            /* Count gray samples in the sub-histograms */
+void add_sample(int value);                                                                           /* Count a single gray sample, likewise */
+void gather_histogram(HISTOGRAM *image);                                    /* Add the counts of a band to those of its image, and clear them */
+void merge_histogram(void);                                             /* Add up the sub-histograms, and the statistics of samples of 1 byte */
+int otsu_threshold(void);                                                           /* The largest sample that becomes black by Otsu's method */
+void put_histogram(int image);                                                                    /* Write the statistics of an image as JSON */
+int get_wide(int ch);
+int get_samples(int *pch, unsigned char *samples, int count, int group, int max);                   /* Tokenize many samples in ASCII at once */
+void put_bytes(const unsigned char *bytes, long count);                                                             /* Put many bytes at once */
+void init_tables(void);                                                                    /* Build the lookup tables of the ASCII formatters */
+void put_decimals(const unsigned char *samples, long count);                    /* Put the decimal equivalents of samples, followed by spaces */
+void put_decimals_wide(const unsigned char *samples, long count);
+void put_bits_ascii(const unsigned char *bytes, long count);                                   /* Put BnW pixels in ASCII, followed by spaces */
+int convert_bands(int kind, int *pch, int width, int height, int max);                  /* Convert the rows of a binary image on many threads */
+void *band_worker(void *arg);                                                                     /* Convert bands of rows until none is left */
+int convert_band(const BANDS *bands, int band);                                                       /* Convert one band of rows into memory */
+void init_kernels(void);                                                         /* Prepare the tables and kernels, before threads share them */
+int convert(int bonus);                                                                    /* Convert the image of the input buffer to output */
+int convert_frame(int bonus);                                                                 /* Convert the next image of a stream to output */
+int next_frame(void);                                                                         /* Check if another image follows in the stream */
+int start_writer(void);                                                                         /* Write output on another thread from now on */
+void *output_writer(void *arg);                                                                      /* Write every block that is handed over */
+void finish_output(void);                                                                     /* Write all the output and wait for the writer */
+int start_reader(void);                                                                     /* Read input ahead on another thread from now on */
+void *input_reader(void *arg);                                                          /* Fill every block of the ring as soon as it is free */
+long next_block(unsigned char **block);                               /* Release the current block and take the next one that has been filled */
+void start_stats(void);                                                                           /* Turn --stats on and report it at the end */
+int switch_phase(int phase);                                                       /* Add the time of the current phase and enter another one */
+void raster_started(int width, int height);                                                         /* The header of an image has been parsed */
+void merge_stats(void);                                                                    /* Add the profile of this thread to the total one */
+void report_stats(void);                                                                           /* Print the profile on the standard error */
+double clock_seconds(void);                                                                                      /* Monotonic time in seconds */
+void *stream_converter(void *arg);                                                                /* Convert the images of a stream of chunks */
+int resume_converter(NETPBM_STREAM *stream);                                            /* Let the converter run until it needs input or ends */
+void release_stream(void);                                                                    /* Let another stream be opened in place of one */
+void pass_turn(void);                                                          /* Let the caller of the stream run and wait for the turn back */
+void write_block(int fd, const unsigned char *block, long count);                                                      /* Write a whole block */
+int convert_batch(int bonus, const char *list, const char *directory);                 /* Convert the images of a list file or of a directory */
+int add_job(BATCH *batch, const char *input, const char *output);                                               /* Append an image to a batch */
+void end_batch(BATCH *batch);                                                         /* Free the jobs, their paths and the queues of a batch */
+int compare_jobs(const void *a, const void *b);                                                            /* Order jobs by their input paths */
+void *batch_worker(void *arg);                                                                           /* Convert images until none is left */
+int next_job(BATCH *batch, int id);                                                       /* Take a job of the worker, or steal one of others */
+void convert_file(BATCH *batch, JOB *job, unsigned char *block);                                        /* Convert an image from file to file */
+int serve(const char *path);                                                  /* Convert the requests of clients on a Unix socket, as --serve */
+void *server_worker(void *arg);                                                      /* Accept clients and convert their requests, one by one */
+void *stop_server(void *arg);                                                        /* Report --stats once the server is stopped by a signal */
+void serve_connection(CONNECTION *connection);                                           /* Convert every request of a client until it leaves */
+long receive(CONNECTION *connection);                                               /* Number of bytes of the client at hand, reading if none */
+int receive_line(CONNECTION *connection, char *line, int size);                                         /* Get a line of the client, or ERROR */
+void send_chunk(void *context, const unsigned char *bytes, long count);                               /* Sink that sends output to the client */
+int get_integer(int *pch);                                                                              /* Convert number in ASCII to integer */
+int white_space_or_comment(int *pch);                                                    /* Check for white space and skip potential comments */
+int white_space(int *pch);                                                                                           /* Check for white space */
+int single_white_character(int *pch);                                                                   /* Check for a single white character */
+int gray2bnw_ascii(int ch);                                                                             /* Convert gray image in ASCII to BnW */
+int color2gray_ascii (int ch);                                                                        /* Convert color image in ASCII to gray */
+int gray2bnw_binary (int ch);                                                                          /* Convert gray image in binary to BnW */
+int color2gray_binary(int ch);                                                                       /* Convert color image in binary to gray */
+int bnw_ascii2binary(int ch);                                                                         /* Convert BnW image in ASCII to binary */
+int gray_ascii2binary(int ch);                                                                       /* Convert gray image in ASCII to binary */
+int color_ascii2binary(int ch);                                                                     /* Convert color image in ASCII to binary */
+int bnw_binary2ascii(int ch);                                                                         /* Convert BnW image in binary to ASCII */
+int gray_binary2ascii(int ch);                                                                       /* Convert gray image in binary to ASCII */
+int color_binary2ascii(int ch);                                                                     /* Convert color image in binary to ASCII */
+int convert_chain(int ch, int target);                                           /* Convert an image straight to any format with fewer colors */
+int convert_region(int *pch, int magic, int target, int width, int height, int max);         /* Convert the pixels of the region that is kept */
+int convert_tuples(int ch, int target);                                            /* Convert a PAM or PFM image, or any image to one of them */
+int get_header(int *pch, int magic, HEADER *header);                          /* Parse the header of an image of any format, up to its raster */
+long get_bytes(int *pch, unsigned char *bytes, long count);                   /* Copy the next bytes of input, and return how many there were */
+int get_floats(int *pch, const HEADER *header, int max);       /* Read the raster of PFM as samples, from the top line down, unless in memory */
+int refill_floats(void);                                             /* Convert the next lines of a PFM in memory and return their first byte */
+const unsigned char *get_tuples(int *pch, int magic, int count, int max);                         /* Get the pixels of the next tuples of PAM */
+void keep_floats(const unsigned char *samples, long count, int max);                    /* Keep output samples as floats, until the last line */
+int put_floats(int width, int height, int depth);                                               /* Put the lines kept, from the bottom one up */
+void end_tuples(void);                                                                                 /* Free the lines of tuples and floats */
+long tuples_size(int magic, int bonus);                                           /* Room that the output of PAM or PFM, or to them, may need */
+const unsigned char *get_pixels(int *pch, int magic, int target, int count, int max, int last);        /* Next pixels of a line of any format */
+void put_pixels(const unsigned char *pixels, int magic, int target, int count, int max, int x, int y);        /* Put pixels in another format */
+void trim_space(void);                                            /* Take back the space after the last pixel in ASCII, if the input had none */
+int start_shrink(int width);                                                                   /* Prepare the boxes of an image of that width */
+void end_shrink(void);                                                                                                      /* Free the boxes */
+int start_levels(int magic, int target, int max);                                        /* Build the lookup tables of -m and -l for an image */
+void end_levels(void);                                                                                                     /* Free the tables */
+double light(double value, int method);                                                     /* The light of a sample from 0 to 1, by a method */
+void weigh_samples(const unsigned char *rgb, unsigned char *gray, int count, int size, int wide);                /* Gray pixels by the tables */
+void weigh_scalar(const unsigned char *rgb, unsigned char *gray, int count);                           /* of samples of a byte, one at a time */
+void weigh_luma_dispatch(const unsigned char *rgb, unsigned char *gray, int count);             /* Choose the best kernel of luma for the CPU */
+#ifdef X86_KERNELS
+void weigh_luma_avx2(const unsigned char *rgb, unsigned char *gray, int count);                               /* Luma for 32 pixels at a time */
+#endif
+void rescale_samples(const unsigned char *samples, unsigned char *output, int count, int size, int wide);           /* Samples with a new max */
+void put_levels(const unsigned char *samples, long count, int kind);                /* Put the pixels of a binary line by the tables, as kind */
+int gray_sample(int red, int green, int blue);                            /* The gray sample of a color pixel, by the tables if there are any */
+void add_boxes(const unsigned char *pixels, int magic, int count, int max, int x);                     /* Add pixels of a line to their boxes */
+void put_boxes(int magic, int target, int width, int lines, int max, int y);                       /* Put the averages of the boxes of a line */
+int skip_units(int *pch, int magic, long count, int last);                         /* Skip bytes of a binary image or samples of an ASCII one */
+int skip_bytes(int *pch, long count);                                                             /* Skip bytes of input, seeking if possible */
+int skip_samples(int *pch, long count, int last);                                            /* Skip samples in ASCII without converting them */
+const unsigned char *shift_bits(const unsigned char *bits, int offset, int count);               /* Drop the first pixels of packed BnW bytes */
+int check_files(int count, char *paths[]);                                          /* Check images for errors without converting, as --check */
+int check_frame(long *error);                                                     /* Check the next image of the input, and where it is wrong */
+int check_bytes(int *pch, long count, int max, long *error);                               /* Check the samples of a binary image against max */
+int check_samples(int *pch, long count, int max, long *error);                                                   /* and those of an ASCII one */
+long input_offset(int ch);                                                                     /* The offset of the current byte in the input */
+
+static void (*luminosity)(const unsigned char *, unsigned char *, int) = luminosity_dispatch;              /* Kernel of the luminosity method */
+static void (*luminosity_wide)(const unsigned char *, unsigned char *, int) = luminosity_wide_dispatch;
+static void (*weigh_luma)(const unsigned char *, unsigned char *, int) = weigh_luma_dispatch;            /* Kernel of -m on bytes, without -l */
+static void (*threshold_pack)(const unsigned char *, unsigned char *, int, int) = threshold_dispatch; /* Kernel of the gray to BnW conversion */
+static void (*ordered_pack)(const unsigned char *, unsigned char *, int, const unsigned char *) = ordered_dispatch; /* and of Bayer dithering */
+static void (*drop_samples)(const unsigned char *, unsigned char *, int, int, int) = drop_samples_dispatch;       /* Kernel of dropping alpha */
+static void (*float_samples)(const unsigned char *, unsigned char *, long, int, int) = float_samples_dispatch;       /* and of reading floats */
+static void (*sample_floats)(const unsigned char *, unsigned char *, long, int) = sample_floats_dispatch;              /* and of writing them */
+static const unsigned char bayer[8][8] = {                          /* Bayer's matrix: the order in which the pixels of 8x8 blocks turn white */
+  { 0, 32,  8, 40,  2, 34, 10, 42}, {48, 16, 56, 24, 50, 18, 58, 26}, {12, 44,  4, 36, 14, 46,  6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+  { 3, 35, 11, 43,  1, 33,  9, 41}, {51, 19, 59, 27, 49, 17, 57, 25}, {15, 47,  7, 39, 13, 45,  5, 37}, {63, 31, 55, 23, 61, 29, 53, 21}
+};
+static ROW *const row_kernels[7][4] = {                /* By the magic number of the output, and by class of max: 255, lower, 65535 and lower */
+  {NULL, NULL, NULL, NULL},
+  {bits_ascii_row, bits_ascii_row, bits_ascii_row, bits_ascii_row},
+  {gray_decimals_row, gray_decimals_checked_row, gray_decimals_wide_row, gray_decimals_wide_checked_row},
+  {color_decimals_row, color_decimals_checked_row, color_decimals_wide_row, color_decimals_wide_checked_row},
+  {threshold_row, threshold_row, threshold_wide_row, threshold_wide_row},                                       /* Gray becomes BnW unchecked */
+  {luminosity_row, luminosity_checked_row, luminosity_wide_row, luminosity_wide_checked_row},
+  {NULL, NULL, NULL, NULL}
+};
+static ROW *const level_kernels[7][2] = {       /* The row kernels of the tables of -m and -l, by the magic number of the output, and checked */
+  {NULL, NULL}, {NULL, NULL},
+  {rescaled_gray_row, rescaled_gray_checked_row},
+  {rescaled_color_row, rescaled_color_checked_row},
+  {NULL, NULL},
+  {weighed_row, weighed_checked_row},
+  {NULL, NULL}
+};
+static int (*const converters[2][7])(int) = {                     /* The converters of the standard and the bonus case, by input magic number */
+  {NULL, NULL, gray2bnw_ascii, color2gray_ascii, NULL, gray2bnw_binary, color2gray_binary},
+  {NULL, bnw_ascii2binary, gray_ascii2binary, color_ascii2binary, bnw_binary2ascii, gray_binary2ascii, color_binary2ascii}
+};
+static const unsigned char token_class[256] = {                    /* Class of each byte for the ASCII tokenizer: digits have their value + 1 */
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+  [' '] = WHITE, ['\t'] = WHITE, ['\n'] = WHITE
+};
+static unsigned char black_bits[256];                    /* BnW byte of the 8 lowest bits of a movemask: white bits are reversed and inverted */
+static unsigned char wide_shuffle[3][3][16];
+static char decimal[256][4];                                          /* Decimal equivalent of each sample, followed by a space (and padding) */
+static char bits_ascii[256][16];                                          /* The 8 BnW pixels of each byte in ASCII, each followed by a space */
+static int tables_ready = 0;                                                                     /* Check if the tables above have been built */
+static int threads = 1;                                                                  /* Number of threads that convert binary images (-j) */
+static int dither = NETPBM_THRESHOLD;                                                                            /* How gray becomes BnW (-d) */
+static int scale = 1;                                                                                /* Factor that images are shrunk by (-s) */
+static REGION crop = {0, 0, 0, 0};                                                                /* The part of images that is kept (--crop) */
+static int maxval = 0;                                                                  /* The max of output images (-m), or 0 to keep theirs */
+static int luminance = NETPBM_LUMA;                                                                            /* How color becomes gray (-l) */
+static _Thread_local LEVELS levels;                                                                 /* The lookup tables of the current image */
+static _Thread_local SHRINK shrink;                                                                         /* The boxes of the current image */
+static _Thread_local DITHER dithering;                                                  /* Floyd-Steinberg or Otsu state of the current image */
+static int histogram_enabled = 0;                                   /* Check if --histogram is on: if off, nothing is counted but for -d otsu */
+static _Thread_local HISTOGRAM histogram;                                                              /* The statistics of the current image */
+static _Thread_local FILE *histogram_file = NULL;                            /* Where they are written: standard error, unless set by a batch */
+static _Thread_local int bare_end = 0;                     /* Check if the last sample of the current image in ASCII is followed by EOF alone */
+static _Thread_local TUPLES tuples;                                                          /* The lines of PAM and PFM of the current image */
+static WRITER writer = {NULL, 0, -1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};                    /* Writer of the pipelined mode */
+static unsigned char *spare_data = NULL;                              /* The block filled while the writer writes the other one, if pipelined */
+static READER reader = {{NULL}, {0}, 0, 0, 0, -1, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};    /* Reader of the pipelined mode */
+static _Thread_local TARGET target;                                                                   /* Output of the library on this thread */
+static int stats_enabled = 0;                                                          /* Check if --stats is on: if off, nothing is measured */
+static _Thread_local STATS stats;                                                                               /* The profile of this thread */
+static STATS total_stats;                                                                      /* The profiles of the threads that have ended */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;                                                          /* Guards total_stats */
+static double stats_start;                                                                                     /* When the conversion started */
+static _Thread_local NETPBM_STREAM *stream = NULL;                                                /* The stream of a converter thread, if any */
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;                                              /* The library prepares the kernels once */
+static pthread_mutex_t streams_lock = PTHREAD_MUTEX_INITIALIZER;
+static int open_streams = 0;                                                                   /* Streams whose converter threads are running */
+
+
+#ifndef NETPBM_LIBRARY
+int main(int argc, char *argv[]) {
+  int arg, bonus = 0, method, pipelined = 0, valid = 1;                                 /* valid: whether every argument so far is understood */
+  char separator, *option, *value, *file = NULL, *list = NULL, *directory = NULL, *socket_path = NULL;
+  atexit(flush_output);                                                               /* Buffered output is written whenever the program ends */
+  if (argc > 1 && !strcmp(argv[1], "--check")) return (check_files(argc - 2, argv + 2));                      /* Only check images, no output */
+  for (arg = 1; arg < argc && valid; arg++) {                              /* The options may come in any order, and each one takes its value */
+    option = argv[arg];
+    if (!strcmp(option, "bonus")) {
+      valid = (bonus == 0);
+      bonus = 1;
+    }
+    else if (!strcmp(option, "-t")) {                                          /* Any image may be converted straight to a format, such as P4 */
+      value = argv[++arg];                                                                      /* argv[argc] is NULL if the value is missing */
+      valid = (bonus == 0 && value != NULL && value[0] == 'P' && ((value[1] >= BnW_ASCII && value[1] <= COLOR_BINARY) || tupled(value[1]))
+               && value[2] == '\0');
+      if (valid) bonus = value[1];                                                         /* The mode is then the magic number of the output */
+    }
+    else if (!strcmp(option, "--stats")) {                                                /* The conversion may be profiled on standard error */
+      if (!stats_enabled) start_stats();
+    }
+    else if (!strcmp(option, "--histogram")) histogram_enabled = 1;                        /* The luminance of every image may be counted too */
+    else if (!strcmp(option, "--crop")) {                                                 /* Only a rectangle of pixels may be kept, and read */
+      value = argv[++arg];
+      valid = (value != NULL && sscanf(value, "%d,%d,%d,%d%c", &crop.x, &crop.y, &crop.width, &crop.height, &separator) == 4
+               && netpbm_set_crop(crop.x, crop.y, crop.width, crop.height) == OK);
+    }
+    else if (!strcmp(option, "-d")) {                                              /* Gray may become BnW by dithering instead of a threshold */
+      value = argv[++arg];
+      method = (value == NULL) ? ERROR : !strcmp(value, "fs") ? NETPBM_FLOYD_STEINBERG : !strcmp(value, "bayer") ? NETPBM_BAYER
+             : !strcmp(value, "otsu") ? NETPBM_OTSU : ERROR;
+      valid = (netpbm_set_dither(method) == OK);
+    }
+    else if (!strcmp(option, "-s")) {                                                      /* Images may be shrunk, averaging boxes of pixels */
+      value = argv[++arg];
+      valid = (value != NULL && netpbm_set_scale(atoi(value)) == OK);
+    }
+    else if (!strcmp(option, "-m")) {                                                                  /* Samples may be put with another max */
+      value = argv[++arg];
+      valid = (value != NULL && atoi(value) > 0 && netpbm_set_maxval(atoi(value)) == OK);
+    }
+    else if (!strcmp(option, "-l")) {                                                    /* Color may become gray by the light of its samples */
+      value = argv[++arg];
+      method = (value == NULL) ? ERROR : !strcmp(value, "luma") ? NETPBM_LUMA : !strcmp(value, "linear") ? NETPBM_LINEAR : ERROR;
+      valid = (netpbm_set_luminosity(method) == OK);
+    }
+    else if (!strcmp(option, "-j")) {                                                       /* Binary images may be converted on many threads */
+      value = argv[++arg];
+      valid = (value != NULL && netpbm_set_threads(atoi(value)) == OK);
+    }
+    else if (!strcmp(option, "-p")) pipelined = 1;                      /* Input may be read ahead and output written behind, while converted */
+    else if (!strcmp(option, "-b")) {                                                                 /* Many images may be converted at once */
+      list = argv[++arg];
+      valid = (list != NULL);
+      if (valid && arg < argc - 1 && argv[arg + 1][0] != '-' && strcmp(argv[arg + 1], "bonus")) directory = argv[++arg];  /* Output directory */
+    }
+    else if (!strcmp(option, "--serve")) {                                                 /* Images may be converted for clients of a socket */
+      socket_path = argv[++arg];
+      valid = (socket_path != NULL);
+    }
+    else {                                                                        /* An input file may be given instead of the standard input */
+      valid = (file == NULL && option[0] != '-');                                                      /* but not an option that is not known */
+      file = option;
+    }
+  }
+  if (list != NULL && (socket_path != NULL || file != NULL || pipelined)) valid = 0;                    /* Batches convert files of their own */
+  if (socket_path != NULL && (file != NULL || pipelined)) valid = 0;                                                     /* and so do servers */
+  if (!valid) {                                                                                           /* Other case: Not supported option */
+    printf("Not supported option, try one of those: \"./netpbm [options] [-p] [file]\" or \"./netpbm [options] -b list\" or");
+    printf(" \"./netpbm [options] -b directory output_directory\" or \"./netpbm [options] --serve socket\" or");
+    printf(" \"./netpbm --check [file ...]\", where the options are");
+    printf(" [bonus | -t format] [--stats] [--histogram] [--crop x,y,width,height] [-d fs | -d bayer | -d otsu] [-s factor] [-m maxval]");
+    printf(" [-l luma | -l linear] [-j threads] in any order,");
+    printf(" and format is one of P1 to P7, PF or Pf.");
+    printf(" Note that -d fs diffuses errors pixel by pixel on one thread, so it is tens of times slower than the other methods,");
+    printf(" that -l linear looks up the samples of every pixel in tables, so it is about three times slower than luma,");
+    printf(" and that -m 255 reduces images of 16 bits to 8 in the same pass.\n");
+    return ERROR;                                                                                                       /* Finish the program */
+  }
+  if (list != NULL) return (convert_batch(bonus, list, directory));                                                     /* Finish the program */
+  if (socket_path != NULL) return (serve(socket_path));                                                        /* Finish the program, if ever */
+  if (pipelined) start_writer();                                                    /* If the thread cannot start, output is written as usual */
+  if (file != NULL) {
+    if (open_input(file) != OK) {
+      printf("Cannot open input file \"%s\".\n", file);
+      return ERROR;                                                                                                     /* Finish the program */
+    }
+  }
+  else map_input(STDIN_FILENO);                                /* Standard input is mapped too if redirected from a file, else read in blocks */
+  if (pipelined) start_reader();                                                        /* If the thread cannot start, input is read as usual */
+  return (convert(bonus));                                                                                              /* Finish the program */
+}
+#endif
+
+long netpbm_output_size(const unsigned char *image, long length, int bonus) {
+  BUFFER saved = in;
+  int ch, magic, kind, width, height, max = 1, digits, size;
+  long bound = HEADER_BYTES, left, pixels, rows;
+  if (image == NULL || length < 0) return NETPBM_ERROR;
+  in.data = in.cursor = (unsigned char *) image;                                            /* Parse the header with the tokenizer of the CLI */
+  in.end = in.data + length;
+  in.size = length;
+  in.fd = -1;
+  ch = get_byte();
+  magic = (ch == 'P') ? get_byte() : EOF;
+  if (tupled(magic) || tupled(bonus)) {                                                              /* PAM and PFM have headers of their own */
+    bound = tuples_size(magic, bonus);
+    in = saved;
+    return bound;
+  }
+  if (bonus > 1) kind = (magic >= BnW_ASCII && magic <= COLOR_BINARY && depth(bonus) <= depth(magic)) ? bonus : 0;    /* Straight to a format */
+  else if (bonus) {
+    kind = (magic >= BnW_ASCII && magic <= COLOR_ASCII) ? magic + 3 : (magic >= BnW_BINARY && magic <= COLOR_BINARY) ? magic - 3 : 0;
+  }
+  else kind = (magic == GRAY_ASCII || magic == COLOR_ASCII || magic == GRAY_BINARY || magic == COLOR_BINARY) ? magic - 1 : 0;
+  ch = get_byte();
+  if (kind != 0 && white_space_or_comment(&ch) == OK && (width = get_integer(&ch)) != ERROR && white_space(&ch) == OK
+      && (height = get_integer(&ch)) != ERROR && white_space(&ch) == OK
+      && (magic == BnW_ASCII || magic == BnW_BINARY || ((max = get_integer(&ch)) != ERROR && max <= MAX_VALUE))) {
+    size = (max > 255) ? 2 : 1;
+    if (maxval > 0) max = maxval;                                                                /* Output samples have the max of -m, if any */
+    digits = 1 + (max >= 10) + (max >= 100) + (max >= 1000) + (max >= 10000);                                        /* of the largest sample */
+    left = in.end - in.cursor + 1;                                                                             /* Bytes that may hold samples */
+    switch (magic) {                                                   /* A truncated image stops early, so count only the pixels it may have */
+      case BnW_BINARY:
+        pixels = 8 * left;
+        break;
+      case GRAY_BINARY: case COLOR_BINARY:
+        pixels = left / (size * ((magic == COLOR_BINARY) ? 3 : 1)) + 1;
+        break;
+      default:                                                                              /* Samples in ASCII take 2 bytes with white space */
+        pixels = (left / 2 + 1) / ((magic == COLOR_ASCII) ? 3 : 1) + 1;
+    }
+    pixels = min(pixels, width * (long) height);
+    rows = (width == 0) ? height : min(height, pixels / width + 1);                                              /* Lines that may be started */
+    switch (kind) {
+      case BnW_ASCII:
+        bound += 2 * pixels + rows;                                                               /* A digit and a space, and a new line each */
+        break;
+      case GRAY_ASCII:
+        bound += (digits + 1) * pixels + rows;
+        break;
+      case COLOR_ASCII:
+        bound += 3 * (digits + 1) * pixels + rows;
+        break;
+      case BnW_BINARY:
+        bound += rows * ((width + 7) / 8);
+        break;
+      case GRAY_BINARY:
+        bound += ((max > 255) ? 2 : 1) * pixels;
+        break;
+      default:                                                                                                                /* COLOR_BINARY */
+        bound += 3 * ((max > 255) ? 2 : 1) * pixels;
+    }
+  }
+  in = saved;
+  return bound;                                                                                     /* Without a valid header, just the error */
+}
+
+long tuples_size(int magic, int bonus) {
+  HEADER header;
+  int ch = get_byte(), target, max, size, digits;
+  long left, pixels, rows, unit;
+  if ((!tupled(magic) && (magic < BnW_ASCII || magic > COLOR_BINARY)) || get_header(&ch, magic, &header) != OK) return HEADER_BYTES;
+  if (magic == PFM_COLOR || magic == PFM_GRAY) header.max = MAX_VALUE;                                /* Floats may become samples of any max */
+  if (bonus == 0 && depth(header.kind) > 1) target = (magic == PAM) ? PAM : (magic == PFM_COLOR) ? PFM_GRAY : BnW_BINARY;     /* As converted */
+  else target = (bonus > 1) ? bonus : BnW_BINARY + depth(header.kind) - 1;
+  max = (maxval > 0) ? maxval : header.max;
+  size = (max > 255) ? 2 : 1;
+  digits = 1 + (max >= 10) + (max >= 100) + (max >= 1000) + (max >= 10000);
+  left = in.end - in.cursor + 1;                                                                               /* Bytes that may hold samples */
+  if (magic == BnW_BINARY) pixels = 8 * left;
+  else if (magic <= COLOR_ASCII) pixels = (left / 2 + 1) / header.depth + 1;                /* Samples in ASCII take 2 bytes with white space */
+  else pixels = left / ((magic == PFM_COLOR || magic == PFM_GRAY) ? 4 : (header.max > 255) ? 2 : 1) / header.depth + 1;
+  pixels = min(pixels, header.width * (long) header.height);
+  rows = (header.width == 0) ? header.height : min(header.height, pixels / header.width + 1);
+  switch (target) {                                                                        /* The most bytes that a pixel takes in the output */
+    case BnW_ASCII:
+      unit = 2;
+      break;
+    case GRAY_ASCII:
+      unit = digits + 1;
+      break;
+    case COLOR_ASCII:
+      unit = 3 * (digits + 1);
+      break;
+    case BnW_BINARY:
+      unit = 1;                                                                           /* More than enough, with the padding of every line */
+      break;
+    case GRAY_BINARY:
+      unit = size;
+      break;
+    case PFM_COLOR:
+      unit = 12;
+      break;
+    case PFM_GRAY:
+      unit = 4;
+      break;
+    default:                                                                                                             /* COLOR_BINARY, PAM */
+      unit = 3 * size;
+  }
+  return 2 * HEADER_BYTES + rows + unit * pixels;                                              /* The header of PAM is longer than the others */
+}
+
+int netpbm_convert(const unsigned char *image, long length, unsigned char *output, long *output_length, int bonus) {
+  BUFFER saved_in = in, saved_out = out;                                                       /* A batch worker may call the library as well */
+  int status;
+  if (image == NULL || length < 0 || output_length == NULL || *output_length < 0 || (output == NULL && *output_length > 0)) return NETPBM_ERROR;
+  target.staging = malloc(BUFFER_SIZE);
+  if (target.staging == NULL) return NETPBM_NO_MEMORY;
+  pthread_once(&kernels_once, init_kernels);                                               /* Before any thread of the caller uses the tables */
+  target.data = output;
+  target.length = 0;
+  target.capacity = *output_length;
+  in.data = in.cursor = (unsigned char *) image;                                                        /* The parsers advance over the image */
+  in.end = in.data + length;
+  in.size = length;
+  in.fd = -1;
+  out.data = out.cursor = output;                                                              /* and the converters put straight into output */
+  out.end = output + *output_length;
+  out.size = *output_length;
+  out.fd = CALLER_BUFFER;
+  status = convert_frame(bonus);
+  end_dither();
+  end_shrink();
+  end_levels();
+  end_tuples();
+  flush_output();
+  if (target.length > target.capacity) status = NETPBM_NO_SPACE;
+  *output_length = target.length;
+  free(target.staging);
+  in = saved_in;
+  out = saved_out;
+  return status;
+}
+
+int netpbm_convert_alloc(const unsigned char *image, long length, unsigned char **output, long *output_length, int bonus) {
+  long size = netpbm_output_size(image, length, bonus);
+  int status;
+  if (size < 0 || output == NULL || output_length == NULL) return NETPBM_ERROR;
+  *output = malloc(size);                                                                      /* Allocate once, since the output always fits */
+  if (*output == NULL) return NETPBM_NO_MEMORY;
+  *output_length = size;
+  status = netpbm_convert(image, length, *output, output_length, bonus);
+  if (status == NETPBM_NO_MEMORY) {
+    free(*output);
+    *output = NULL;
+  }
+  return status;
+}
+
+int netpbm_check(const unsigned char *image, long length, long *error_offset) {
+  BUFFER saved = in;
+  long saved_consumed = consumed, error = 0;
+  int status;
+  if (image == NULL || length < 0) return NETPBM_ERROR;
+  in.data = in.cursor = (unsigned char *) image;                                                        /* The parsers advance over the image */
+  in.end = in.data + length;
+  in.size = length;
+  in.fd = -1;
+  consumed = 0;
+  status = check_frame(&error);
+  in = saved;
+  consumed = saved_consumed;
+  if (error_offset != NULL) *error_offset = (status == OK) ? -1 : error;
+  return (status == OK) ? NETPBM_OK : NETPBM_ERROR;
+}
+
+int netpbm_set_dither(int method) {
+  if (method < NETPBM_THRESHOLD || method > NETPBM_OTSU) return NETPBM_ERROR;
+  dither = method;                                                                           /* Set before conversions start, not during them */
+  return NETPBM_OK;
+}
+
+int netpbm_set_crop(int x, int y, int width, int height) {
+  if (x < 0 || y < 0 || width < 1 || height < 1) return NETPBM_ERROR;
+  crop.x = x;                                                                                /* Set before conversions start, not during them */
+  crop.y = y;
+  crop.width = width;
+  crop.height = height;
+  return NETPBM_OK;
+}
+
+int netpbm_set_scale(int factor) {
+  if (factor < 1 || factor > MAX_SCALE) return NETPBM_ERROR;
+  scale = factor;                                                                            /* Set before conversions start, not during them */
+  return NETPBM_OK;
+}
+
+int netpbm_set_maxval(int max) {
+  if (max < 0 || max > MAX_VALUE) return NETPBM_ERROR;
+  maxval = max;                                                                              /* Set before conversions start, not during them */
+  return NETPBM_OK;
+}
+
+int netpbm_set_luminosity(int method) {
+  if (method != NETPBM_LUMA && method != NETPBM_LINEAR) return NETPBM_ERROR;
+  luminance = method;                                                                        /* Set before conversions start, not during them */
+  return NETPBM_OK;
+}
+
+int netpbm_set_threads(int count) {
+  if (count < 1 || count > MAX_THREADS) return NETPBM_ERROR;
+  threads = count;                                                                           /* Set before conversions start, not during them */
+  return NETPBM_OK;
+}
+
+NETPBM_STREAM *netpbm_stream_open(int bonus, void (*sink)(void *context, const unsigned char *bytes, long count), void *context) {
+  NETPBM_STREAM *stream;
+  pthread_attr_t attributes;
+  int started;
+  if (sink == NULL) return NULL;
+  pthread_mutex_lock(&streams_lock);
+  started = (open_streams < NETPBM_MAX_STREAMS) ? ++open_streams : 0;                             /* Each one holds a thread, so they are few */
+  pthread_mutex_unlock(&streams_lock);
+  if (!started) return NULL;
+  if ((stream = calloc(1, sizeof(NETPBM_STREAM))) == NULL) {
+    release_stream();
+    return NULL;
+  }
+  pthread_once(&kernels_once, init_kernels);
+  stream->bonus = bonus;
+  stream->sink = sink;
+  stream->context = context;
+  stream->turn = CONVERTER;                                                               /* It runs first, until it asks for the first chunk */
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->changed, NULL);
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, STREAM_STACK);                                   /* The converters keep their lines out of the stack */
+  started = pthread_create(&stream->thread, &attributes, stream_converter, stream) == 0;
+  pthread_attr_destroy(&attributes);
+  if (!started) {
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->changed);
+    free(stream);
+    release_stream();
+    return NULL;
+  }
+  pthread_mutex_lock(&stream->lock);
+  while (stream->turn == CONVERTER) pthread_cond_wait(&stream->changed, &stream->lock);                  /* until it asks for the first chunk */
+  pthread_mutex_unlock(&stream->lock);
+  return stream;
+}
+
+int netpbm_stream_feed(NETPBM_STREAM *stream, const unsigned char *bytes, long count) {
+  if (stream->finished) return stream->status;                           /* Anything after the end of the conversion is ignored, like the CLI */
+  if (bytes == NULL || count <= 0) return (count < 0) ? NETPBM_ERROR : NETPBM_OK;
+  stream->chunk = bytes;                                                            /* The converter is done with the chunk when this returns */
+  stream->count = count;
+  return resume_converter(stream);
+}
+
+int netpbm_stream_close(NETPBM_STREAM *stream) {
+  int status;
+  if (!stream->finished) {
+    stream->ended = 1;                                                                                  /* The converter gets EOF from now on */
+    resume_converter(stream);
+  }
+  pthread_join(stream->thread, NULL);
+  status = stream->status;
+  pthread_mutex_destroy(&stream->lock);
+  pthread_cond_destroy(&stream->changed);
+  free(stream);
+  release_stream();
+  return status;
+}
+
+void release_stream(void) {
+  pthread_mutex_lock(&streams_lock);
+  open_streams--;
+  pthread_mutex_unlock(&streams_lock);
+}
+
+void *stream_converter(void *arg) {
+  int status;
+  stream = arg;
+  in.fd = STREAM;                                                                      /* Every refill waits for the next chunk of the caller */
+  in.data = in.cursor = in.end = NULL;
+  in.size = 0;
+  out.fd = STREAM;                                                                             /* and every flush hands a block to the caller */
+  out.data = out.cursor = stream->output;
+  out.size = BUFFER_SIZE;
+  out.end = out.data + out.size;
+  status = convert(stream->bonus);                                                                        /* Every image is flushed when done */
+  if (stats_enabled) merge_stats();                                     /* The profile of the thread is kept, as for every request of --serve */
+  pthread_mutex_lock(&stream->lock);
+  stream->status = status;
+  stream->finished = 1;
+  stream->turn = CALLER;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+  return NULL;
+}
+
+int resume_converter(NETPBM_STREAM *stream) {
+  pthread_mutex_lock(&stream->lock);
+  stream->turn = CONVERTER;
+  pthread_cond_broadcast(&stream->changed);
+  while (1) {
+    while (stream->turn == CONVERTER) pthread_cond_wait(&stream->changed, &stream->lock);
+    if (stream->block == NULL) break;                                                              /* It needs more input, or it has finished */
+    pthread_mutex_unlock(&stream->lock);
+    stream->sink(stream->context, stream->block, stream->length);                                         /* while the converter waits for it */
+    pthread_mutex_lock(&stream->lock);
+    stream->block = NULL;
+    stream->turn = CONVERTER;
+    pthread_cond_broadcast(&stream->changed);
+  }
+  pthread_mutex_unlock(&stream->lock);
+  return stream->finished ? stream->status : NETPBM_OK;
+}
+
+void pass_turn(void) {
+  pthread_mutex_lock(&stream->lock);
+  stream->turn = CALLER;
+  pthread_cond_broadcast(&stream->changed);
+  while (stream->turn == CALLER) pthread_cond_wait(&stream->changed, &stream->lock);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+int convert(int bonus) {
+  int status, image = 0;
+  do {                                                                                  /* A stream may hold many images, one after the other */
+    enter_phase(PARSING_HEADER);
+    status = convert_frame(bonus);
+    if (status == OK && histogram_enabled) put_histogram(++image);                   /* The statistics of every image that is converted whole */
+    end_dither();                                                                                 /* The errors of a dithered image are freed */
+    end_shrink();
+    end_levels();
+    end_tuples();
+    flush_output();                                                                           /* Every frame is written as soon as it is done */
+  } while (status == OK && next_frame() == OK);
+  enter_phase(STARTING);
+  return status;
+}
+
+int next_frame(void) {
+  int ch = get_byte();
+  while (ch != EOF && token_class[ch] == WHITE) ch = get_byte();                                    /* Frames may be separated by white space */
+  if (ch != 'P') return ERROR;                                                                     /* Anything else after an image is ignored */
+  unget_byte(ch);                                                                                                 /* The 'P' starts the frame */
+  return OK;
+}
+
+int convert_frame(int bonus) {
+  if (bonus > 1 || transformed()) {                         /* Chained case: Convert any image straight to the format of bonus, or reshape it */
+    int ch;                                                                                /* Declare ch as int because of get_byte() and EOF */
+    ch = get_byte();                                                                                                     /* Get the next byte */
+    if (ch == 'P') {                                                                            /* Every magic number should start with a 'P' */
+      put_byte(ch);                                                                                       /* 'P' should be included in output */
+      ch = get_byte();                                                                                                   /* Get the next byte */
+      if (tupled(ch)) return (convert_tuples(ch, bonus));                                              /* PAM and PFM have cases of their own */
+      if (ch >= BnW_ASCII && ch <= COLOR_BINARY) {
+        if (bonus == 0 && depth(ch) == 1) exit();                                                         /* BnW images have no standard case */
+        if (bonus == 0) bonus = ch - 1;                                                                      /* The format of a standard case */
+        else if (bonus == 1) bonus = (ch <= COLOR_ASCII) ? ch + 3 : ch - 3;                                             /* or of a bonus case */
+        if (transformed()) return (convert_chain(ch, bonus));                                         /* A reshaped image needs the chain too */
+        if (bonus == ch - 1 && converters[0][ch - '0'] != NULL) return (converters[0][ch - '0'](ch));     /* A single step is a standard case */
+        if ((bonus == ch + 3 && !tupled(bonus)) || bonus == ch - 3) return (converters[1][ch - '0'](ch));                  /* or a bonus case */
+        return (convert_chain(ch, bonus));                                                        /* Else all the steps are taken in one pass */
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else if (bonus == 0) {                           /* Standard case: Convert color image(.ppm) to gray(.pgm) or gray image(.pgm) to BnW(.pbm) */
+    int ch;                                                                                /* Declare ch as int because of get_byte() and EOF */
+    ch = get_byte();                                                                                                     /* Get the next byte */
+    if (ch == 'P') {                                                                            /* Every magic number should start with a 'P' */
+      put_byte(ch);                                                                                       /* 'P' should be included in output */
+      ch = get_byte();                                                                                                   /* Get the next byte */
+      switch (ch) {                                                                            /* Choose the conversion based on magic number */
+        case GRAY_ASCII:
+          return (gray2bnw_ascii(ch));                                                                                  /* Finish the program */
+        case COLOR_ASCII:
+          return (color2gray_ascii (ch));                                                                               /* Finish the program */
+        case GRAY_BINARY:
+          return (gray2bnw_binary (ch));                                                                                /* Finish the program */
+        case COLOR_BINARY:
+          return (color2gray_binary(ch));                                                                               /* Finish the program */
+        case PAM: case PFM_COLOR: case PFM_GRAY:                                                         /* Tuples drop a level of colors too */
+          return (convert_tuples(ch, 0));                                                                               /* Finish the program */
+        default:                                                                                     /* If none of the above cases, then exit */
+          exit();
+      }
+    }
+    else exit();
+  }
+  else {                                                                /* Bonus case: Convert ASCII image to binary or binary image to ASCII */
+    int ch;                                                                                /* Declare ch as int because of get_byte() and EOF */
+    ch = get_byte();                                                                                                     /* Get the next byte */
+    if (ch == 'P') {                                                                            /* Every magic number should start with a 'P' */
+      put_byte(ch);                                                                                       /* 'P' should be included in output */
+      ch = get_byte();                                                                                                   /* Get the next byte */
+      switch (ch) {                                                                            /* Choose the conversion based on magic number */
+        case BnW_ASCII:
+          return (bnw_ascii2binary(ch));                                                                                /* Finish the program */
+        case GRAY_ASCII:
+          return (gray_ascii2binary(ch));                                                                               /* Finish the program */
+        case COLOR_ASCII:
+          return (color_ascii2binary(ch));                                                                              /* Finish the program */
+        case BnW_BINARY:
+          return (bnw_binary2ascii(ch));                                                                                /* Finish the program */
+        case GRAY_BINARY:
+          return (gray_binary2ascii(ch));                                                                               /* Finish the program */
+        case COLOR_BINARY:
+          return (color_binary2ascii(ch));                                                                              /* Finish the program */
+        case PAM: case PFM_COLOR: case PFM_GRAY:                                           /* Tuples become the binary format of their pixels */
+          return (convert_tuples(ch, 1));                                                                               /* Finish the program */
+        default:                                                                                     /* If none of the above cases, then exit */
+          exit();
+      }
+    }
+    else exit();
+  }
+}
+
+int gray2bnw_ascii(int ch) {                                                                            /* Convert gray image in ASCII to BnW */
+  int width, height, max, h, w, pixel, count, i;
+  static _Thread_local unsigned char samples[ROW_CHUNK];                                         /* Pixels tokenized straight from the buffer */
+  static _Thread_local unsigned char white[ROW_CHUNK];                                                       /* The white pixels, if dithered */
+  put_byte(ch - 1);                                                               /* Magic numbers are consecutive, so go to the previous one */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE) {                                                                  /* Check if max is valid */
+              if (white_space(&ch) == OK && start_dither(width) == OK) {                                             /* Check for white space */
+                start_raster(width, height);
+                start_histogram(width, height, max, histogram_enabled);               /* The gray samples are counted, before they become BnW */
+                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
+                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
+                    count = get_samples(&ch, samples, min(width - w + 1, ROW_CHUNK), 1, max);                 /* Tokenize many pixels at once */
+                    if (count > 0 && histogram.active) add_histogram(samples, count, 0);
+                    if (count > 0 && dither != NETPBM_THRESHOLD) {
+                      dither_samples(samples, white, count, w - 1, h - 1, max);
+                      for (i = 0; i < count; i++) {
+                        put_byte(white[i] ? '0' : '1');                                 /* The dithering found the color of each output pixel */
+                        put_byte(' ');
+                      }
+                      w += count - 1;
+                    }
+                    else if (count > 0) {                                                /* Each of them is valid and followed by white space */
+                      for (i = 0; i < count; i++) {
+                        put_byte((samples[i] > (max + 1) / 2) ? '0' : '1');                     /* Find the color of the current output pixel */
+                        put_byte(' ');                                                 /* and put a space as the white space needed in output */
+                      }
+                      w += count - 1;                                                                  /* The loop moves on to the next pixel */
+                    }
+                    else {                                                         /* Else convert one pixel at a time, to find what is wrong */
+                      pixel = get_integer(&ch);                                                                        /* Current input pixel */
+                      if (pixel != ERROR && pixel <= max) {                                          /* Check if current input pixel is valid */
+                        count_sample(pixel);
+                        if (dither != NETPBM_THRESHOLD) pixel = dither_pixel(pixel, w - 1, h - 1, max) ? '0' : '1';
+                        else pixel = (pixel > (max + 1) / 2) ? '0' : '1';                       /* Find the color of the current output pixel */
+                        put_byte(pixel);
+                      }
+                      else exit();
+                      if (white_space(&ch) == OK) {                                                          /* Check if there is white space */
+                        put_byte(' ');                                                 /* and put a space as the white space needed in output */
+                      }
+                      else if (w != width || h != height) {                                /* Else check if the current pixel is the last one */
+                        exit();                                                                       /* and if not, exit with error notation */
+                      }
+                    }
+                  }
+                  put_byte('\n');                                                          /* Change line as the white space needed in output */
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int color2gray_ascii (int ch) {
+  int width, height, max, h, w, red, green, blue, pixel, count, pixels = 0;       /* pixels: the number of collected pixels not converted yet */
+  static _Thread_local unsigned char samples[3 * ROW_CHUNK];                                /* The collected pixels, to be converted together */
+  put_byte(ch - 1);                                                               /* Magic numbers are consecutive, so go to the previous one */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE && start_levels(COLOR_ASCII, GRAY_ASCII, max) == OK) {              /* Check if max is valid */
+              put_integer(levels.last);                                                           /* Output image has the same max, unless -m */
+              if (white_space(&ch) == OK) {                                                                          /* Check for white space */
+                put_byte('\n');                                                            /* Change line as the white space needed in output */
+                start_raster(width, height);
+                start_histogram(width, height, levels.last, histogram_enabled);                /* The samples counted are those of the output */
+                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
+                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
+                    count = get_samples(&ch, samples + 3 * pixels, 3 * min(width - w + 1, ROW_CHUNK - pixels), 3, max) / 3;
+                    if (count > 0) {                                                     /* Each of them is valid and followed by white space */
+                      pixels += count;
+                      w += count - 1;                                                                  /* The loop moves on to the next pixel */
+                      if (pixels == ROW_CHUNK || w == width) {                        /* Convert when enough pixels or the line are collected */
+                        put_luminosity_ascii(samples, pixels);
+                        pixels = 0;
+                      }
+                    }
+                    else {                                                         /* Else convert one pixel at a time, to find what is wrong */
+                      red = get_integer(&ch);                                       /* The value of color red in current pixel of input image */
+                      if (red != ERROR && red <= max) {                                                     /* Check if value of red is valid */
+                        if (white_space(&ch) == OK) {                                                                /* Check for white space */
+                          green = get_integer(&ch);                               /* The value of color green in current pixel of input image */
+                          if (green != ERROR && green <= max) {                                           /* Check if value of green is valid */
+                            if (white_space(&ch) == OK) {                                                            /* Check for white space */
+                              blue = get_integer(&ch);                             /* The value of color blue in current pixel of input image */
+                              if (blue != ERROR && blue <= max) {                                          /* Check if value of blue is valid */
+                                if (max > 255) {                                            /* Samples of 2 bytes are put one pixel at a time */
+                                  pixel = gray_sample(red, green, blue);
+                                  count_sample(pixel);
+                                  put_integer(pixel);
+                                  if (white_space(&ch) == OK) put_byte(' ');
+                                  else if (w != width || h != height) exit();
+                                }
+                                else {
+                                  samples[3 * pixels] = red;                       /* Collect the pixel, so that the luminosity method can find
+                                                                                                     the colors of many output pixels at once */
+                                  samples[3 * pixels + 1] = green;
+                                  samples[3 * pixels + 2] = blue;
+                                  pixels++;
+                                  if (white_space(&ch) == OK) {                                              /* Check if there is white space */
+                                    if (pixels == ROW_CHUNK || w == width) {          /* Convert when enough pixels or the line are collected */
+                                      put_luminosity_ascii(samples, pixels);          /* Each pixel is followed by a space as the white space */
+                                      pixels = 0;
+                                    }
+                                  }
+                                  else {
+                                    put_luminosity_ascii(samples, pixels - 1);              /* The current pixel has no white space after it, */
+                                    pixel = gray_sample(red, green, blue);                                         /* so it is put on its own */
+                                    count_sample(pixel);
+                                    put_integer(pixel);
+                                    pixels = 0;
+                                    if (w != width || h != height) {                       /* Else check if the current pixel is the last one */
+                                      exit();                                                         /* and if not, exit with error notation */
+                                    }
+                                  }
+                                }
+                              }
+                              else {put_luminosity_ascii(samples, pixels); exit();}            /* The collected pixels are put before exiting */
+                            }
+                            else {put_luminosity_ascii(samples, pixels); exit();}
+                          }
+                          else {put_luminosity_ascii(samples, pixels); exit();}
+                        }
+                        else {put_luminosity_ascii(samples, pixels); exit();}
+                      }
+                      else {put_luminosity_ascii(samples, pixels); exit();}
+                    }
+                  }
+                  put_byte('\n');                                                          /* Change line as the white space needed in output */
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int gray2bnw_binary (int ch) {
+  int width, height, max, size, h, w, pixels = 0xFF, white;
+  unsigned char *row;                                                                           /* The current line of the input, if buffered */
+  ROW *put_row;
+  put_byte(ch - 1);                                                               /* Magic numbers are consecutive, so go to the previous one */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE) {                                                                  /* Check if max is valid */
+              size = (max > 255) ? 2 : 1;
+              if (single_white_character(&ch) == OK && start_dither(width) == OK) {                     /* Check for a single white character */
+                start_raster(width, height);
+                start_histogram(width, height, max, histogram_enabled);               /* The gray samples are counted, before they become BnW */
+                put_row = row_kernel(BnW_BINARY, max);                                          /* Chosen once for all the lines of the image */
+                for (h = convert_bands(BnW_BINARY, &ch, width, height, max); h <= height; h++) {      /* h: current height from top to bottom */
+                  row = in.cursor - 1;                                                  /* The current byte (ch) is the first one of the line */
+                  if (ch != EOF && in.end - row >= size * (long) width) {                  /* Check if the whole line is buffered, and if yes */
+                    put_row(row, width, h - 1, max);                                                   /* convert it into whole bytes at once */
+                    in.cursor = row + size * (long) width;
+                    ch = get_byte();                                                                           /* Get the byte after the line */
+                    if (ch == EOF && h != height) exit();                            /* If EOF sooner than expected, exit with error notation */
+                  }
+                  else {                                                            /* Else convert one pixel at a time, to find where EOF is */
+                    for (w = 1; w <= width; w++) {                                                     /* w: current width from left to right */
+                      if (size == 2 && (ch = get_wide(ch)) == MAX_SIGNED_INT) exit();                    /* A sample of 2 bytes is cut by EOF */
+                      if (w%8 == 1) {                                                 /* Check if current output pixel is the first of a byte */
+                        pixels = 0xFF;                  /* If yes, then reset pixels to 11111111 (due to ace padding at the end of each line) */
+                      }
+                      count_sample(ch);
+                      white = (dither != NETPBM_THRESHOLD) ? dither_pixel(ch, w - 1, h - 1, max) : ch > (max + 1) / 2;
+                      if (white) {                                      /* Check if the color of the current output pixel should be white (0) */
+                        pixels &= ~(0x80 >> (w-1)%8);                                         /* If yes, then "clean" it by using an AND-mask */
+/* Note: By default when shifting force 0-fill, so by using (~) after (>>) the AND-mask is full of 1 except the bit that should get "cleaned" */
+                      }
+                      if (w%8 == 0 || w == width) {          /* Check if the current output pixel is the last of a byte or the last of a line */
+                        put_byte(pixels);                                                                    /* If yes, then put current byte */
+                      }
+                      ch = get_byte();                                                                                   /* Get the next byte */
+                      if (ch == EOF  && (w != width || h != height)) exit();         /* If EOF sooner than expected, exit with error notation */
+                    }
+                  }
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int color2gray_binary(int ch) {
+  int width, height, max, size, h, w, pixel, red, green, blue;
+  unsigned char *row;                                                                           /* The current line of the input, if buffered */
+  ROW *put_row;
+  put_byte(ch - 1);                                                               /* Magic numbers are consecutive, so go to the previous one */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE && start_levels(COLOR_BINARY, GRAY_BINARY, max) == OK) {            /* Check if max is valid */
+              size = (max > 255) ? 2 : 1;
+              put_integer(levels.last);                                                           /* Output image has the same max, unless -m */
+              if (single_white_character(&ch) == OK) {                                                  /* Check for a single white character */
+                put_byte('\n');                                                            /* Change line as the white space needed in output */
+                start_raster(width, height);
+                start_histogram(width, height, levels.last, histogram_enabled);                /* The samples counted are those of the output */
+                put_row = row_kernel(GRAY_BINARY, max);                                         /* Chosen once for all the lines of the image */
+                for (h = convert_bands(GRAY_BINARY, &ch, width, height, max); h <= height; h++) {     /* h: current height from top to bottom */
+                  row = in.cursor - 1;                                                  /* The current byte (ch) is the first one of the line */
+                  if (ch != EOF && in.end - row >= 3 * size * (long) width + (h != height) && put_row(row, width, h - 1, max) == OK) {
+/* Note: The byte after the line must be buffered too (unless it is the last line), so that EOF is found before any pixel of the line is put */
+/* Note: The kernel puts nothing unless the whole line is valid */
+                    in.cursor = row + 3 * size * (long) width;
+                    ch = get_byte();                                        /* Get the byte after the line, once the line is no longer needed */
+                  }
+                  else {                                                      /* Else convert one pixel at a time, to find where the error is */
+                    for (w = 1; w <= width; w++) {                                                     /* w: current width from left to right */
+                      if (size == 2) ch = get_wide(ch);                                                    /* A cut sample is larger than max */
+                      if (ch <= max) {                                               /* Check if the value for the first color (red) is valid */
+                        red = ch;
+                        ch = get_byte();                                                                                 /* Get the next byte */
+                        if (ch == EOF) exit();                                       /* If EOF sooner than expected, exit with error notation */
+                        if (size == 2) ch = get_wide(ch);
+                        if (ch <= max) {                                            /* Check if the value for the next color (green) is valid */
+                          green = ch;
+                          ch = get_byte();                                                                               /* Get the next byte */
+                          if (ch == EOF) exit();                                     /* If EOF sooner than expected, exit with error notation */
+                          if (size == 2) ch = get_wide(ch);
+                          if (ch <= max) {                                           /* Check if the value for the last color (blue) is valid */
+                            blue = ch;
+                            ch = get_byte();                                                                             /* Get the next byte */
+                            if (ch == EOF && (w != width || h != height)) exit();    /* If EOF sooner than expected, exit with error notation */
+                            pixel = gray_sample(red, green, blue);                                /* Find the color of the current output pixel
+                                                                                                     based on luminosity method or the tables */
+                            count_sample(pixel);
+                            put_sample(pixel, levels.last);
+                          }
+                          else exit();
+                        }
+                        else exit();
+                      }
+                      else exit();
+                    }
+                  }
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int bnw_ascii2binary(int ch) {
+  int width, height, h, w, pixels = 0xFF, count, i, zero;
+  static _Thread_local unsigned char samples[ROW_CHUNK];                                         /* Pixels tokenized straight from the buffer */
+  put_byte(ch + 3);                                 /* To convert the magic number of an image in ASCII to binarry, add 3 to the numeric part */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            start_raster(width, height);
+            start_histogram(width, height, 1, histogram_enabled);                            /* BnW is counted as 0 for black and 1 for white */
+            for (h = 1; h <= height; h++) {                                                           /* h: current height from top to bottom */
+              for (w = 1; w <= width; w++) {                                                           /* w: current width from left to right */
+                count = get_samples(&ch, samples, min(width - w + 1, ROW_CHUNK), 1, 1);                       /* Tokenize many pixels at once */
+                if (count > 0) {                                                         /* Each of them is valid and followed by white space */
+                  if (histogram.active) count_pixels(samples, BnW_ASCII, BnW_BINARY, count, 0);
+                  i = ((w - 1) % 8 != 0) ? 0 : (w + count - 1 == width) ? count : count - count % 8;              /* Whole bytes, or the line */
+                  put_packed(samples, i);                                                             /* are packed at once, with the padding */
+                  for (w += i; i < count; i++, w++) {                                                    /* and any other pixel one at a time */
+                    if (w%8 == 1) {                                                   /* Check if current output pixel is the first of a byte */
+                      pixels = 0xFF;                    /* If yes, then reset pixels to 11111111 (due to ace padding at the end of each line) */
+                    }
+                    if (samples[i] == 0) {                                                /* Check if the numeric value of current pixel is 0 */
+                      pixels &= ~(0x80 >> (w-1)%8);                                                   /* Then "clean" it by using an AND-mask */
+                    }
+                    if (w%8 == 0 || w == width) {            /* Check if the current output pixel is the last of a byte or the last of a line */
+                      put_byte(pixels);                                                                     /* If yes, then put current pixel */
+                    }
+                  }
+                  w--;                                                                                 /* The loop moves on to the next pixel */
+                }
+                else {                                                             /* Else convert one pixel at a time, to find what is wrong */
+                  if (w%8 == 1) {                                                     /* Check if current output pixel is the first of a byte */
+                    pixels = 0xFF;                      /* If yes, then reset pixels to 11111111 (due to ace padding at the end of each line) */
+                  }
+                  zero = (ch == '0');                                                                   /* A pixel of 0 has at least one zero */
+                  while (ch == '0') {                                                                 /* Skip the leading zeros of the number */
+                    ch = get_byte();                                                                                     /* Get the next byte */
+                  }
+                  if (white_space(&ch) == OK ||                   /* Check the first non-zero byte: after white space, the numeric value is 0 */
+                      (zero && w == width && h == height && (ch == EOF || !is_digit(ch)))) {              /* or the last pixel ends the image */
+                    pixels &= ~(0x80 >> (w-1)%8);                                                     /* Then "clean" it by using an AND-mask */
+                    count_sample(1);
+/* Note: By default when shifting force 0-fill, so by using (~) after (>>) the AND-mask is full of 1 except the bit that should get "cleaned" */
+                  }
+                  else if (ch == '1') {                     /* If the first non-zero byte is '1' then the numeric value of current pixel is 1 */
+                    count_sample(0);
+                    ch = get_byte();                                                                                     /* Get the next byte */
+                    if (white_space(&ch) != OK) {                                           /* Check if there is no white space after an '1', */
+                      if (w != width || h != height) {                            /* but exclude the last pixel, before EOF or the next image */
+                        put_byte(pixels);      /* In any other case of no white space, put the current byte (the unchecked bits will be aces) */
+                        exit();                                                                          /* and then exit with error notation */
+                      }
+                    }
+                  }
+                  else exit();                                  /* If after zeros there is no white space or an '1', exit with error notation */
+                  if (w%8 == 0 || w == width) {              /* Check if the current output pixel is the last of a byte or the last of a line */
+                    put_byte(pixels);                                                                       /* If yes, then put current pixel */
+                  }
+                }
+              }
+            }
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int gray_ascii2binary(int ch) {
+  int width, height, max, h, w, pixel, count;
+  static _Thread_local unsigned char samples[ROW_CHUNK];                                         /* Pixels tokenized straight from the buffer */
+  put_byte(ch + 3);                                 /* To convert the magic number of an image in ASCII to binarry, add 3 to the numeric part */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE && start_levels(GRAY_ASCII, GRAY_BINARY, max) == OK) {              /* Check if max is valid */
+              put_integer(levels.last);                                                           /* Output image has the same max, unless -m */
+              if (white_space(&ch) == OK) {                                                                          /* Check for white space */
+                put_byte('\n');                                                            /* Change line as the white space needed in output */
+                start_raster(width, height);
+                start_histogram(width, height, levels.last, histogram_enabled);                /* The samples counted are those of the output */
+                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
+                  for (w = 1; w <= width; w ++) {                                                      /* w: current width from left to right */
+                    count = get_samples(&ch, samples, min(width - w + 1, ROW_CHUNK), 1, max);                 /* Tokenize many pixels at once */
+                    if (count > 0) {                                                     /* Each of them is valid and followed by white space */
+                      if (levels.rescale != NULL) put_levels(samples, count, GRAY_BINARY);                /* The samples may change their max */
+                      else {
+                        if (histogram.active) add_histogram(samples, count, 0);
+                        put_bytes(samples, count);
+                      }
+                      w += count - 1;                                                                  /* The loop moves on to the next pixel */
+                    }
+                    else {                                                         /* Else convert one pixel at a time, to find what is wrong */
+                      pixel = get_integer(&ch);                                                                        /* Current input pixel */
+                      if (pixel != ERROR && pixel <= max) {                                          /* Check if current input pixel is valid */
+                        count_sample(leveled(pixel));
+                        put_sample(leveled(pixel), levels.last);
+                        if (white_space(&ch) != OK) {                                                     /* Check if there is no white space */
+                          if (w != width || h != height) {                        /* but exclude the last pixel, before EOF or the next image */
+                            exit();                                                                           /* and exit with error notation */
+                          }
+                        }
+                      }
+                      else exit();
+                    }
+                  }
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int color_ascii2binary(int ch) {
+  int width, height, max, h, w, subpixel, color, count, rgb[3]; //red, green, blue;
+  static _Thread_local unsigned char samples[3 * ROW_CHUNK];                                     /* Pixels tokenized straight from the buffer */
+  put_byte(ch + 3);                                 /* To convert the magic number of an image in ASCII to binarry, add 3 to the numeric part */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE && start_levels(COLOR_ASCII, COLOR_BINARY, max) == OK) {            /* Check if max is valid */
+              put_integer(levels.last);                                                           /* Output image has the same max, unless -m */
+              if (white_space(&ch) == OK) {                                                                          /* Check for white space */
+                put_byte('\n');                                                            /* Change line as the white space needed in output */
+                start_raster(width, height);
+                start_histogram(width, height, levels.last, histogram_enabled);                /* The samples counted are those of the output */
+                for (h = 1; h <= height; h++) {                                                       /* h: current height from top to bottom */
+                  for (w = 1; w <= width; w++) {                                                       /* w: current width from left to right */
+                    count = get_samples(&ch, samples, 3 * min(width - w + 1, ROW_CHUNK), 3, max);             /* Tokenize many pixels at once */
+                    if (count > 0) {                                                     /* Each of them is valid and followed by white space */
+                      if (levels.rescale != NULL) put_levels(samples, count / 3, COLOR_BINARY);           /* The samples may change their max */
+                      else {
+                        if (histogram.active) count_pixels(samples, COLOR_BINARY, COLOR_BINARY, count / 3, 0);
+                        put_bytes(samples, count);
+                      }
+                      w += count / 3 - 1;                                                              /* The loop moves on to the next pixel */
+                    }
+                    else {                                                         /* Else convert one pixel at a time, to find what is wrong */
+                      for (color = 1; color <= 3; color ++) {                                        /* Each pixel consists of 3 colors (RGB) */
+                        subpixel = get_integer(&ch);                                                          /* Current subpixel value (RGB) */
+                        if (subpixel != ERROR && subpixel <= max) {                                       /* Check if subpixel value is valid */
+                          rgb[color - 1] = leveled(subpixel);
+                          put_sample(rgb[color - 1], levels.last);
+                          if (white_space(&ch) != OK) {                                                   /* Check if there is no white space */
+                            if (color != 3 || w != width || h != height) {        /* but exclude the last pixel, before EOF or the next image */
+                              exit();                                                                         /* and exit with error notation */
+                            }
+                          }
+                        }
+                        else exit();
+                      }
+                      count_sample(gray_sample(rgb[0], rgb[1], rgb[2]));                  /* Color is counted by the luminosity of its pixels */
+                    }
+                  }
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int bnw_binary2ascii(int ch) {
+  int width, height, h, w, pixel;
+  unsigned char *row;                                                                           /* The current line of the input, if buffered */
+  if (!tables_ready) init_tables();
+  put_byte(ch - 3);                            /* To convert the magic number of an image in binarry to ASCII, subtract 3 by the numeric part */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (single_white_character(&ch) == OK) {                                                      /* Check for a single white character */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            start_raster(width, height);
+            start_histogram(width, height, 1, histogram_enabled);                            /* BnW is counted as 0 for black and 1 for white */
+            for (h = convert_bands(BnW_ASCII, &ch, width, height, 1); h <= height; h++) {             /* h: current height from top to bottom */
+              row = in.cursor - 1;                                                      /* The current byte (ch) is the first one of the line */
+              if (ch != EOF && in.end - row >= (width + 7) / 8) {                                     /* Check if the whole line is buffered, */
+                if (histogram.active) count_pixels(row, BnW_BINARY, BnW_ASCII, width, 0);
+                put_bits_ascii(row, width);                                                     /* and if yes, then format it with the tables */
+                in.cursor = row + (width + 7) / 8;
+                ch = get_byte();                                                                               /* Get the byte after the line */
+                if (ch == EOF && h != height) exit();                                /* If EOF sooner than expected, exit with error notation */
+              }
+              else {                                                                /* Else convert one pixel at a time, to find where EOF is */
+                for (w = 1; w <= width; w++) {                                                         /* w: current width from left to right */
+                  pixel = ch;                                                                                             /* Save ch as pixel */
+                  pixel &= 0x80;                                        /* Use AND-mask in orded to isolate the first bit and fill with zeros */
+                  pixel = (pixel == 0x00) ? '0' : '1';                         /* If the first bit is 0 then current pixel is 0, else it is 1 */
+                  count_sample(pixel == '0');                                                                                   /* 0 is white */
+                  put_byte(pixel);
+                  put_byte(' ');                                                           /* Put a space as the white space needed in output */
+                  ch <<= 1;                                                            /* Left shift ch by 1, so the next bit becomes the msb */
+                  if (w % 8 == 0 || w == width) {            /* Check if the current output pixel is the last of a byte or the last of a line */
+                    ch = get_byte();                                                                                     /* Get the next byte */
+                    if (ch == EOF && (w != width || h != height)) exit();            /* If EOF sooner than expected, exit with error notation */
+                  }
+                }
+              }
+              put_byte('\n');                                                              /* Change line as the white space needed in output */
+            }
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int gray_binary2ascii(int ch) {
+  int width, height, max, size, h, w;
+  unsigned char *row;                                                                           /* The current line of the input, if buffered */
+  ROW *put_row;
+  if (!tables_ready) init_tables();
+  put_byte(ch - 3);                            /* To convert the magic number of an image in binarry to ASCII, subtract 3 by the numeric part */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for gray color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE && start_levels(GRAY_BINARY, GRAY_ASCII, max) == OK) {              /* Check if max is valid */
+              size = (max > 255) ? 2 : 1;
+              put_integer(levels.last);                                                           /* Output image has the same max, unless -m */
+              if (single_white_character(&ch) == OK) {                                                  /* Check for a single white character */
+                put_byte('\n');                                                            /* Change line as the white space needed in output */
+                start_raster(width, height);
+                start_histogram(width, height, levels.last, histogram_enabled);                /* The samples counted are those of the output */
+                put_row = row_kernel(GRAY_ASCII, max);                                          /* Chosen once for all the lines of the image */
+                for (h = convert_bands(GRAY_ASCII, &ch, width, height, max); h <= height; h++) {      /* h: current height from top to bottom */
+                  row = in.cursor - 1;                                                  /* The current byte (ch) is the first one of the line */
+                  if (ch != EOF && in.end - row >= size * (long) width && put_row(row, width, h - 1, max) == OK) {
+                    in.cursor = row + size * (long) width;
+                    ch = get_byte();                                                                           /* Get the byte after the line */
+                    if (ch == EOF && h != height) exit();                            /* If EOF sooner than expected, exit with error notation */
+                  }
+                  else {                                                               /* Else convert one pixel at a time, to find the error */
+                    for (w = 1; w <= width; w++) {                                                     /* w: current width from left to right */
+                      if (size == 2) ch = get_wide(ch);                                                    /* A cut sample is larger than max */
+                      if (ch <= max) {                                                                     /* Check if current pixel is valid */
+                        count_sample(leveled(ch));
+                        put_integer(leveled(ch)); put_byte(' ');                                        /* Print the decimal equivalent of ch */
+                        ch = get_byte();                                                                                 /* Get the next byte */
+                        if (ch == EOF && (w != width || h != height)) exit();        /* If EOF sooner than expected, exit with error notation */
+                      }
+                      else exit();
+                    }
+                  }
+                  put_byte('\n');                                                          /* Change line as the white space needed in output */
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int color_binary2ascii(int ch) {
+  int width, height, max, size, h, w, color, rgb[3];
+  unsigned char *row;                                                                           /* The current line of the input, if buffered */
+  ROW *put_row;
+  if (!tables_ready) init_tables();
+  put_byte(ch - 3);                            /* To convert the magic number of an image in binarry to ASCII, subtract 3 by the numeric part */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR) {                                                                                          /* Check if width is valid */
+      put_integer(width);                                                                                  /* Output image has the same width */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR) {                                                                                    /* Check if height is valid */
+          put_integer(height);                                                                            /* Output image has the same height */
+          if (white_space(&ch) == OK) {                                                                              /* Check for white space */
+            put_byte('\n');                                                                /* Change line as the white space needed in output */
+            max = get_integer(&ch);                                          /* The maximum value for each color in pixels of the input image */
+            if (max != ERROR && max <= MAX_VALUE && start_levels(COLOR_BINARY, COLOR_ASCII, max) == OK) {            /* Check if max is valid */
+              size = (max > 255) ? 2 : 1;
+              put_integer(levels.last);                                                           /* Output image has the same max, unless -m */
+              if (single_white_character(&ch) == OK) {                                                  /* Check for a single white character */
+                put_byte('\n');                                                            /* Change line as the white space needed in output */
+                start_raster(width, height);
+                start_histogram(width, height, levels.last, histogram_enabled);                /* The samples counted are those of the output */
+                put_row = row_kernel(COLOR_ASCII, max);                                         /* Chosen once for all the lines of the image */
+                for (h = convert_bands(COLOR_ASCII, &ch, width, height, max); h <= height; h++) {     /* h: current height from top to bottom */
+                  row = in.cursor - 1;                                                  /* The current byte (ch) is the first one of the line */
+                  if (ch != EOF && in.end - row >= 3 * size * (long) width && put_row(row, width, h - 1, max) == OK) {
+                    in.cursor = row + 3 * size * (long) width;
+                    ch = get_byte();                                                                           /* Get the byte after the line */
+                    if (ch == EOF && h != height) exit();                            /* If EOF sooner than expected, exit with error notation */
+                  }
+                  else {                                                               /* Else convert one pixel at a time, to find the error */
+                    for (w = 1; w <= width; w++) {                                                     /* w: current width from left to right */
+                      for (color = 1; color <= 3; color ++) {                                        /* Each pixel consists of 3 colors (RGB) */
+                        if (size == 2) ch = get_wide(ch);                                                  /* A cut sample is larger than max */
+                        if (ch <= max) {                                                  /* Check if the value of the current color is valid */
+                          rgb[color - 1] = leveled(ch);
+                          put_integer(rgb[color - 1]); put_byte(' ');                                /* Print the decimal equivalent of pixel */
+                          ch = get_byte();                                                                               /* Get the next byte */
+                          if (ch == EOF && (w != width || h != height)) exit();      /* If EOF sooner than expected, exit with error notation */
+                        }
+                        else exit();
+                      }
+                      count_sample(gray_sample(rgb[0], rgb[1], rgb[2]));                  /* Color is counted by the luminosity of its pixels */
+                    }
+                  }
+                  put_byte('\n');                                                          /* Change line as the white space needed in output */
+                }
+              }
+              else exit();
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int convert_chain(int ch, int target) {
+  int magic = ch, width, height, max = 1;                                                                        /* magic: of the input image */
+  int left, top, columns, lines;                                                      /* The region that is kept, all of the image by default */
+  if (tupled(target)) return (convert_tuples(magic, target));                                            /* PAM and PFM are written as tuples */
+  if (depth(target) > depth(magic)) exit();                                                       /* Colors that are not there cannot be made */
+  put_byte(target);                                                               /* The output is the last image of the chain of conversions */
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (white_space_or_comment(&ch) == OK) {                                               /* Check for white space and skip potential comments */
+    put_byte('\n');                                                                        /* Change line as the white space needed in output */
+    width = get_integer(&ch);                                                                       /* The width of the input image in pixels */
+    if (width != ERROR && (crop.width == 0 || crop.x < width)) {                       /* Check if width is valid, and the crop starts inside */
+      left = min(crop.x, width);
+      columns = (crop.width > 0) ? min(crop.width, width - left) : width;                     /* A crop is cut at the right side of the image */
+      put_integer(shrunk(columns));                                                       /* Output image has the same width, unless reshaped */
+      if (white_space(&ch) == OK) {                                                                                  /* Check for white space */
+        put_byte(' ');                                                                 /* and put a space as the white space needed in output */
+        height = get_integer(&ch);                                                                 /* The height of the input image in pixels */
+        if (height != ERROR && (crop.height == 0 || crop.y < height)) {                             /* Check if height is valid, and likewise */
+          top = min(crop.y, height);
+          lines = (crop.height > 0) ? min(crop.height, height - top) : height;                                           /* and at the bottom */
+          put_integer(shrunk(lines));                                                    /* Output image has the same height, unless reshaped */
+          if (depth(magic) == 1 || (white_space(&ch) == OK && (max = get_integer(&ch)) != ERROR && max <= MAX_VALUE)) {     /* BnW has no max */
+            if (depth(target) > 1) {                                                      /* Output image has the same max, if any, unless -m */
+              put_byte('\n');
+              put_integer((maxval > 0) ? maxval : max);
+            }
+            if ((magic >= BnW_BINARY) ? single_white_character(&ch) == OK : white_space(&ch) == OK) {         /* Binary pixels follow at once */
+              if (convert_region(&ch, magic, target, width, height, max) != OK) return ERROR;               /* The error has been put already */
+            }
+            else exit();
+          }
+          else exit();
+        }
+        else exit();
+      }
+      else exit();
+    }
+    else exit();
+  }
+  else exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int convert_region(int *pch, int magic, int target, int width, int height, int max) {
+  int left = min(crop.x, width), top = min(crop.y, height), columns, lines, first, h, w, count;
+  int deferred = (dither == NETPBM_OTSU && depth(magic) > 1 && depth(target) == 1);                        /* Otsu's lines are put at the end */
+  long row, margin, span, tail;                             /* In bytes of binary images or samples of ASCII ones: the units that are skipped */
+  const unsigned char *pixels;
+  columns = (crop.width > 0) ? min(crop.width, width - left) : width;                        /* The region that is kept, as in the header put */
+  lines = (crop.height > 0) ? min(crop.height, height - top) : height;
+  bare_end = 0;
+  if (!tables_ready) init_tables();
+  if (start_dither(shrunk(columns)) != OK || start_shrink(shrunk(columns)) != OK || start_levels(magic, target, max) != OK) exit();
+  start_histogram(shrunk(columns), shrunk(lines), (depth(magic) == 1) ? 1 : (maxval > 0 && depth(target) > 1) ? maxval : max,
+                  histogram_enabled || deferred);                                              /* The samples counted are those of the output */
+  put_byte('\n');                                                                          /* Change line as the white space needed in output */
+  if (magic == BnW_BINARY) {                                                               /* Lines of P4 start at a byte, the region may not */
+    row = (width + 7) / 8;
+    margin = left / 8;
+    span = (left % 8 + columns + 7) / 8;
+  }
+  else {
+    span = (tuples.depth > 0) ? tuples.depth : (depth(magic) == 3) ? 3 : 1;         /* The units of a pixel: its samples, as many as PAM has, */
+    span *= (magic >= BnW_BINARY && max > 255) ? 2 : 1;                                              /* of 2 bytes in binary with a large max */
+    row = span * width;
+    margin = span * left;
+    span *= columns;
+  }
+  tail = row - margin - span + (long) (height - top - lines) * row;                     /* From the end of the region to the end of the image */
+  start_raster(columns, lines);
+  if (skip_units(pch, magic, (lines > 0) ? top * row + margin : height * row, lines == 0) != OK) exit();                  /* Above the region */
+  for (h = 1; h <= lines; h++) {                                                        /* h: current height from top to bottom of the region */
+    for (w = 0; w < columns; w += count) {                                                  /* w: the pixels of the line that are already put */
+      first = (magic == BnW_BINARY && w == 0) ? left % 8 : 0;                                   /* Pixels of the first byte that are not kept */
+      count = min(columns - w, ROW_CHUNK - first);                                                      /* A multiple of 8, except at the end */
+      pixels = get_pixels(pch, magic, target, first + count, max, h == lines && w + count == columns && tail == 0);
+      if (pixels == NULL) exit();
+      if (first != 0) pixels = shift_bits(pixels, first, count);
+      if (scale > 1) add_boxes(pixels, magic, count, max, w);                                 /* Only a line of boxes is kept while shrinking */
+      else put_pixels(pixels, magic, target, count, max, w, h - 1);
+    }
+    if (target != magic - 1) bare_end = 0;                     /* A chain of more steps, or of binary ones, has white space after every pixel */
+    if (skip_units(pch, magic, (h < lines) ? row - span : tail, h == lines) != OK) exit();                           /* Up to the next region */
+    if (scale > 1 && h % scale != 0 && h != lines) continue;                                      /* The boxes still miss some of their lines */
+    if (scale > 1) put_boxes(magic, target, columns, (h - 1) % scale + 1, max, (h - 1) / scale);
+    if (target <= COLOR_ASCII && !deferred) {                                                 /* Lines of images in ASCII end with a new line */
+      if (h == lines) trim_space();
+      put_byte('\n');
+    }
+  }
+  if (deferred && put_otsu(target, shrunk(columns), shrunk(lines), max) != OK) exit();
+  return OK;
+}
+
+int convert_tuples(int ch, int target) {
+  int magic = ch, left, top, columns, lines, kind, last, size, status, next = EOF;                               /* magic: of the input image */
+  HEADER header;
+  BUFFER saved;
+  ch = get_byte();                                                                                                       /* Get the next byte */
+  if (get_header(&ch, magic, &header) != OK) exit();
+  if (crop.width > 0 && (crop.x >= header.width || crop.y >= header.height)) exit();                    /* A crop must start inside the image */
+  if (target == 0 && depth(header.kind) == 1) exit();                                                     /* BnW images have no standard case */
+  if (target <= 1) {                                  /* The bonus case gives the P4, P5 or P6 of the pixels, and the standard case one level */
+    kind = BnW_BINARY + depth(header.kind) - 1 - (target == 0);           /* of colors less, in the same format: PAM, or PFM unless it is BnW */
+    target = (target == 1) ? kind : (magic == PAM) ? PAM : (magic == PFM_COLOR) ? PFM_GRAY : kind;
+  }
+  else if (target == PAM) kind = BnW_BINARY + depth(header.kind) - 1;       /* The format that the output is put as, before it becomes tuples */
+  else kind = (target == PFM_COLOR) ? COLOR_BINARY : (target == PFM_GRAY) ? GRAY_BINARY : target;
+  if (depth(kind) > depth(header.kind)) exit();                                                   /* Colors that are not there cannot be made */
+  if (magic == PFM_COLOR || magic == PFM_GRAY) header.max = (maxval > 0) ? maxval : (tupled(target) && target != PAM) ? MAX_VALUE : 255;
+  size = (header.max > 255) ? 2 : 1;
+  tuples.depth = (magic == PAM) ? header.depth : 0;
+  tuples.output = tupled(target) ? target : 0;
+  tuples.used = 0;
+  if (tupled(magic)) {                                                              /* A line of tuples or of floats may be split by a refill */
+    tuples.copy = malloc((magic == PAM) ? (size_t) size * header.depth * ROW_CHUNK : 4 * (size_t) header.depth * header.width + 1);
+    if (tuples.copy == NULL) exit();
+  }
+  left = min(crop.x, header.width);
+  top = min(crop.y, header.height);
+  columns = shrunk((crop.width > 0) ? min(crop.width, header.width - left) : header.width);        /* Output image has the size of the region */
+  lines = shrunk((crop.height > 0) ? min(crop.height, header.height - top) : header.height);
+  last = (depth(kind) == 1) ? 1 : (maxval > 0) ? maxval : header.max;                                  /* and the same max, if any, unless -m */
+  if (target == PAM) {
+    put_string("7\nWIDTH ");
+    put_integer(columns);
+    put_string("\nHEIGHT ");
+    put_integer(lines);
+    put_string((depth(kind) == 3) ? "\nDEPTH 3\nMAXVAL " : "\nDEPTH 1\nMAXVAL ");
+    put_integer(last);
+    put_string((depth(kind) == 1) ? "\nTUPLTYPE BLACKANDWHITE" : (depth(kind) == 2) ? "\nTUPLTYPE GRAYSCALE" : "\nTUPLTYPE RGB");
+    put_string("\nENDHDR");
+  }
+  else {
+    put_byte(target);
+    put_byte('\n');
+    put_integer(columns);
+    put_byte(' ');
+    put_integer(lines);
+    if (tupled(target)) put_string("\n-1.0");                                               /* A negative scale: the floats are little endian */
+    else if (depth(target) > 1) {
+      put_byte('\n');
+      put_integer(last);
+    }
+  }
+  if (magic == PFM_COLOR || magic == PFM_GRAY) {                             /* The floats are read whole, since the bottom line comes first, */
+    if (get_floats(&ch, &header, header.max) != OK) exit();
+    next = ch;
+    saved = in;
+    in.data = in.cursor = in.end = tuples.samples;                          /* and the chain reads their samples, like the raster of P5 or P6 */
+    if (tuples.raster == NULL) in.end += (long) size * header.depth * header.width * header.height;
+    in.size = in.end - in.data;
+    in.fd = (tuples.raster != NULL) ? FLOATS : -1;                           /* unless they are in memory, and are converted as they are read */
+    ch = get_byte();
+  }
+  status = convert_region(&ch, header.kind, kind, header.width, header.height, header.max);
+  if (magic == PFM_COLOR || magic == PFM_GRAY) {
+    in = saved;
+    ch = next;
+  }
+  if (status != OK) return ERROR;                                                                           /* The error has been put already */
+  if ((tuples.output == PFM_COLOR || tuples.output == PFM_GRAY) && put_floats(columns, lines, (depth(kind) == 3) ? 3 : 1) != OK) exit();
+  unget_byte(ch);                                                                          /* The byte after the image may start the next one */
+  return OK;
+}
+
+int get_header(int *pch, int magic, HEADER *header) {
+  char line[128], word[16], type[64] = "", *end;
+  int at;
+  long value;
+  double factor;
+  header->max = 1;
+  header->little = 0;
+  if (magic == PAM) {
+    header->width = header->height = header->depth = -1;
+    header->max = 0;
+    if (single_white_character(pch) != OK) return ERROR;
+    while (1) {                                                                             /* Lines of a keyword and its value, up to ENDHDR */
+      for (at = 0; *pch != '\n' && *pch != EOF; *pch = get_byte()) {
+        if (at < (int) sizeof(line) - 1) line[at++] = *pch;                                                           /* Longer lines are cut */
+      }
+      if (*pch == EOF) return ERROR;
+      line[at] = '\0';
+      *pch = get_byte();                                                                     /* The raster follows the line of ENDHDR at once */
+      if (line[0] == '#' || sscanf(line, "%15s %n", word, &at) != 1) continue;                               /* Skip comments and empty lines */
+      if (!strcmp(word, "ENDHDR")) break;
+      if (!strcmp(word, "TUPLTYPE")) {
+        if (type[0] == '\0') snprintf(type, sizeof(type), "%s", line + at);
+        continue;
+      }
+      value = strtol(line + at, &end, 10);
+      while (*end == ' ' || *end == '\t' || *end == '\r') end++;
+      if (end == line + at || *end != '\0' || value < 0 || value > MAX_SIGNED_INT) return ERROR;
+      if (!strcmp(word, "WIDTH")) header->width = value;
+      else if (!strcmp(word, "HEIGHT")) header->height = value;
+      else if (!strcmp(word, "DEPTH")) header->depth = value;
+      else if (!strcmp(word, "MAXVAL")) header->max = value;
+      else return ERROR;
+    }
+    if (header->width < 0 || header->height < 0 || header->depth < 1 || header->max < 1 || header->max > MAX_VALUE) return ERROR;
+    if (!strncmp(type, "BLACKANDWHITE", 13)) {                                       /* BnW tuples are bytes of 0 or 1, like the pixels of P1 */
+      if (header->max != 1) return ERROR;
+      header->kind = BnW_ASCII;
+    }
+    else if (!strncmp(type, "RGB", 3) && header->depth < 3) return ERROR;
+    else header->kind = (header->depth >= 3 && strncmp(type, "GRAYSCALE", 9) != 0) ? COLOR_BINARY : GRAY_BINARY;  /* Any depth is gray or RGB */
+  }
+  else if (magic == PFM_COLOR || magic == PFM_GRAY) {
+    if (white_space(pch) != OK || (header->width = get_integer(pch)) == ERROR || white_space(pch) != OK
+        || (header->height = get_integer(pch)) == ERROR || white_space(pch) != OK) return ERROR;
+    for (at = 0; at < (int) sizeof(word) - 1 && *pch > 0 && strchr("+-.0123456789eE", *pch) != NULL; *pch = get_byte()) word[at++] = *pch;
+    word[at] = '\0';
+    factor = strtod(word, &end);
+    if (at == 0 || *end != '\0' || factor == 0 || single_white_character(pch) != OK) return ERROR;
+    header->little = (factor < 0);                                        /* The sign of the scale is the byte order, and its size is ignored */
+    header->depth = (magic == PFM_COLOR) ? 3 : 1;
+    header->kind = (magic == PFM_COLOR) ? COLOR_BINARY : GRAY_BINARY;
+  }
+  else {
+    if (white_space_or_comment(pch) != OK || (header->width = get_integer(pch)) == ERROR || white_space(pch) != OK
+        || (header->height = get_integer(pch)) == ERROR
+        || (depth(magic) > 1 && (white_space(pch) != OK || (header->max = get_integer(pch)) == ERROR || header->max > MAX_VALUE))
+        || ((magic >= BnW_BINARY) ? single_white_character(pch) : white_space(pch)) != OK) return ERROR;      /* The same header as the chain */
+    header->depth = (depth(magic) == 3) ? 3 : 1;
+    header->kind = magic;
+  }
+  return OK;
+}
+
+long get_bytes(int *pch, unsigned char *bytes, long count) {
+  long done = 0, step;
+  while (done < count && *pch != EOF) {
+    bytes[done++] = *pch;
+    step = min(in.end - in.cursor, count - done);                                                           /* The rest of the buffer at once */
+    memcpy(bytes + done, in.cursor, step);
+    in.cursor += step;
+    done += step;
+    *pch = get_byte();
+  }
+  return done;
+}
+
+int get_floats(int *pch, const HEADER *header, int max) {
+  int size = (max > 255) ? 2 : 1, y;
+  long count = (long) header->depth * header->width, bytes = 4 * count;                                                          /* Of a line */
+  const unsigned char *row = in.cursor - 1;
+  free(tuples.samples);
+  tuples.raster = NULL;
+  if (in.fd == -1 && *pch != EOF && bytes > 0 && (in.end - row) / bytes >= header->height) {          /* A mapped file, or an image in memory */
+    tuples.samples = malloc((size_t) size * count * min(header->height, float_block(bytes)) + 1);                   /* takes a block of lines */
+    if (tuples.samples == NULL) return ERROR;
+    tuples.raster = row;
+    tuples.header = *header;
+    tuples.header.max = max;
+    tuples.lines = header->height;
+    in.cursor = (unsigned char *) row + bytes * header->height;                                      /* The byte after the raster, or the end */
+    *pch = get_byte();
+    return OK;
+  }
+  tuples.samples = malloc((size_t) size * count * header->height + 1);
+  if (tuples.samples == NULL) return ERROR;
+  for (y = header->height - 1; y >= 0; y--) {                                                                  /* The bottom line comes first */
+    row = in.cursor - 1;                                                              /* The current byte (*pch) is the first one of the line */
+    if (*pch != EOF && in.end - row > bytes) {
+      in.cursor = (unsigned char *) row + bytes;
+      *pch = get_byte();
+    }
+    else if (get_bytes(pch, tuples.copy, bytes) == bytes) row = tuples.copy;
+    else return ERROR;                                                                                            /* EOF sooner than expected */
+    float_samples(row, tuples.samples + y * size * count, count, max, header->little);
+  }
+  return OK;
+}
+
+int refill_floats(void) {
+  long count = (long) tuples.header.depth * tuples.header.width, bytes = 4 * count;
+  int size = (tuples.header.max > 255) ? 2 : 1, block = min(tuples.lines, float_block(bytes)), i;
+  if (block == 0 || count == 0) return EOF;                                                                       /* The raster has been read */
+  for (i = 0; i < block; i++) {
+    tuples.lines--;                                                                            /* The top line left is the last one in memory */
+    float_samples(tuples.raster + tuples.lines * bytes, tuples.samples + i * size * count, count, tuples.header.max, tuples.header.little);
+  }
+  in.data = in.cursor = tuples.samples;
+  in.end = in.data + (long) block * size * count;
+  in.size = in.end - in.data;
+  return *in.cursor++;
+}
+
+const unsigned char *get_pixels(int *pch, int magic, int target, int count, int max, int last) {
+  static _Thread_local unsigned char copy[6 * ROW_CHUNK];                               /* The pixels, when they cannot be used in the buffer */
+  const unsigned char *row = in.cursor - 1;                                         /* The current byte (*pch) is the first one of the pixels */
+  int size = (max > 255) ? 2 : 1, samples = (depth(magic) == 3) ? 3 * count : count, n, got, value;
+  long bytes = (magic == BnW_BINARY) ? (count + 7) / 8 : (long) size * samples, i;
+  if (tuples.depth > 0) return (get_tuples(pch, magic, count, max));                                       /* PAM has tuples of its own depth */
+  if (magic >= BnW_BINARY) {
+    if (*pch != EOF && in.end - row > bytes) {         /* The byte after the pixels is buffered too, so getting it does not refill the buffer */
+      in.cursor = (unsigned char *) row + bytes;
+      *pch = get_byte();
+    }
+    else {                                                                         /* Else copy them one byte at a time, to find where EOF is */
+      for (i = 0; i < bytes; i++) {
+        if (*pch == EOF) return NULL;                                                                             /* EOF sooner than expected */
+        copy[i] = *pch;
+        *pch = get_byte();
+      }
+      row = copy;
+    }
+    if (magic == GRAY_BINARY && depth(target) == 1) return row;          /* Gray that becomes BnW is thresholded as it is, like P5 -> P4 does */
+    return (magic == BnW_BINARY || valid_samples(row, samples, max) == OK) ? row : NULL;
+  }
+  for (n = 0; n < samples; n += got) {
+    got = get_samples(pch, copy + n, samples - n, 1, max);                                                   /* Tokenize many samples at once */
+    if (got == 0) {                                                              /* Else tokenize one sample at a time, to find what is wrong */
+      value = get_integer(pch);
+      if (value == ERROR || value > max) return NULL;
+      if (size == 2) copy[2 * n] = value >> 8;                                                             /* The most significant byte first */
+      copy[size * n + size - 1] = value & 0xFF;
+      if (white_space(pch) != OK) {
+        if (!last || n != samples - 1) return NULL;               /* Only the last sample may lack white space, before EOF or the next image, */
+        bare_end = 1;                                                                 /* and then the converters put no space after its pixel */
+      }
+      got = 1;
+    }
+  }
+  return copy;
+}
+
+const unsigned char *get_tuples(int *pch, int magic, int count, int max) {
+  static _Thread_local unsigned char pixels[6 * ROW_CHUNK + 16];                               /* With room for the last store of the kernels */
+  const unsigned char *row = in.cursor - 1;                                         /* The current byte (*pch) is the first one of the tuples */
+  int size = (max > 255) ? 2 : 1, kept = (depth(magic) == 3) ? 3 : 1, i;
+  long bytes = (long) size * tuples.depth * count;
+  if (*pch != EOF && in.end - row > bytes) {            /* Like pixels, the tuples are used in the buffer if the byte after them is there too */
+    in.cursor = (unsigned char *) row + bytes;
+    *pch = get_byte();
+  }
+  else if (get_bytes(pch, tuples.copy, bytes) == bytes) row = tuples.copy;
+  else return NULL;                                                                                               /* EOF sooner than expected */
+  if (valid_samples(row, (long) tuples.depth * count, max) != OK) return NULL;
+  if (magic == BnW_ASCII) {                                                               /* 0 is black in PAM, but white in the pixels of P1 */
+    for (i = 0; i < count; i++) pixels[i] = !row[(long) i * tuples.depth];
+    return pixels;
+  }
+  if (tuples.depth == kept) return row;                                             /* Tuples of gray or RGB alone are the pixels of P5 or P6 */
+  drop_samples(row, pixels, count, size * tuples.depth, size * kept);           /* Else alpha and any samples after the kept ones are dropped */
+  return pixels;
+}
+
+void put_pixels(const unsigned char *pixels, int magic, int target, int count, int max, int x, int y) {
+  static _Thread_local unsigned char gray[6 * ROW_CHUNK], white[ROW_CHUNK], bits[ROW_CHUNK / 8];        /* The steps between input and output */
+  int size = (max > 255) ? 2 : 1, samples = (depth(target) == 3) ? 3 * count : count, i, threshold;
+  int last = (maxval > 0 && depth(target) > 1) ? maxval : max;                                                   /* The max of output samples */
+  int phase = enter_phase(RUNNING_KERNELS);
+  if (depth(magic) == 3 && depth(target) < 3) {                                                /* Color becomes gray by the luminosity method */
+    if (levels.weights != NULL) weigh_samples(pixels, gray, count, size, last > 255);                        /* or by the tables of -m and -l */
+    else if (size == 2) luminosity_wide(pixels, gray, count);
+    else luminosity(pixels, gray, count);
+    pixels = gray;
+  }
+  else if (levels.rescale != NULL) {                                                       /* Gray and color keep their samples, at a new max */
+    rescale_samples(pixels, gray, samples, size, last > 255);
+    pixels = gray;
+  }
+  max = last;
+  size = (max > 255) ? 2 : 1;
+  if (histogram.active) count_pixels(pixels, magic, target, count, size == 2);
+  if (depth(magic) > 1 && depth(target) == 1) {                                         /* and gray becomes BnW, packed 8 pixels in each byte */
+    if (dither == NETPBM_OTSU && dithering.threshold < 0) {                           /* Otsu's threshold is known once every line is counted */
+      keep_samples(pixels, size * (long) count);
+      enter_phase(phase);
+      return;
+    }
+    threshold = (dither == NETPBM_OTSU) ? dithering.threshold : (max + 1) / 2;
+    if (dither == NETPBM_FLOYD_STEINBERG || dither == NETPBM_BAYER) {
+      dither_samples(pixels, white, count, x, y, max);
+      threshold_pack(white, bits, count, 127);
+    }
+    else if (size == 2) {
+      for (i = 0; i < count; i++) {
+        white[i] = ((pixels[2 * i] << 8 | pixels[2 * i + 1]) > threshold) ? 255 : 0;        /* Branchless, so that the compiler vectorizes it */
+      }
+      threshold_pack(white, bits, count, 127);
+    }
+    else threshold_pack(pixels, bits, count, threshold);
+    pixels = bits;
+  }
+  else if (magic == BnW_ASCII) {                                                                        /* BnW pixels in ASCII are packed too */
+    memset(bits, 0xFF, (count + 7) / 8);
+    for (i = 0; i < count; i++) {
+      if (pixels[i] == 0) bits[i / 8] &= ~(0x80 >> i % 8);                                                        /* "Clean" the white pixels */
+    }
+    pixels = bits;
+  }
+  switch (target) {
+    case BnW_ASCII:
+      put_bits_ascii(pixels, count);
+      break;
+    case BnW_BINARY:
+      if (tuples.output == PAM) {                                                 /* BnW tuples of PAM are bytes, 0 for black and 1 for white */
+        for (i = 0; i < count; i++) white[i] = !(pixels[i / 8] & 0x80 >> i % 8);
+        put_bytes(white, count);
+        break;
+      }
+      put_bytes(pixels, count / 8);
+      if (count % 8 != 0) put_byte(pixels[count / 8] | 0xFF >> count % 8);                             /* Ace padding at the end of each line */
+      break;
+    case GRAY_ASCII: case COLOR_ASCII:
+      if (size == 2) put_decimals_wide(pixels, samples);
+      else put_decimals(pixels, samples);
+      break;
+    default:                                                                                                     /* GRAY_BINARY, COLOR_BINARY */
+      if (tuples.output == PFM_COLOR || tuples.output == PFM_GRAY) keep_floats(pixels, samples, max);           /* PFM starts from the bottom */
+      else put_bytes(pixels, size * (long) samples);
+  }
+  enter_phase(phase);
+}
+
+void trim_space(void) {
+  if (bare_end && out.cursor > out.data && out.cursor[-1] == ' ') out.cursor--;                /* Output is flushed before a put, never after */
+}
+
+int skip_units(int *pch, int magic, long count, int last) {
+  return (magic >= BnW_BINARY || tuples.depth > 0) ? skip_bytes(pch, count) : skip_samples(pch, count, last);
+}
+
+int skip_bytes(int *pch, long count) {
+  struct stat info;
+  off_t offset;
+  long step;
+  if (count == 0) return OK;
+  if (*pch == EOF) return ERROR;
+  step = min(in.end - in.cursor, count - 1);                                              /* The current byte (*pch) is the first one skipped */
+  in.cursor += step;                                                                       /* A mapped input skips pages without reading them */
+  count -= step + 1;
+  if (count > in.size && in.fd >= 0 && in.fd != reader.fd                                          /* The reader of -p owns the file position */
+      && fstat(in.fd, &info) == 0 && S_ISREG(info.st_mode) && (offset = lseek(in.fd, 0, SEEK_CUR)) >= 0) {
+    if (offset + count > info.st_size) {
+      consumed += info.st_size - offset;                                                                /* An error is at the end of the file */
+      *pch = EOF;
+      return ERROR;
+    }
+    if (lseek(in.fd, offset + count, SEEK_SET) < 0) return ERROR;                                            /* A file skips whole blocks too */
+    consumed += count;
+    count = 0;
+  }
+  while (count > 0) {                                                                     /* Else the blocks are read and dropped, like pipes */
+    if (refill_input() == EOF) {
+      *pch = EOF;                                                                                                  /* The error is at the end */
+      return ERROR;
+    }
+    in.cursor--;
+    step = min(in.end - in.cursor, count);
+    in.cursor += step;
+    count -= step;
+  }
+  *pch = get_byte();
+  return OK;
+}
+
+int skip_samples(int *pch, long count, int last) {
+  const unsigned char *next, *mark;
+  long n = 0;
+  int i, starts, other, white;
+  while (n < count) {
+    if (*pch != EOF) {                                             /* Samples that are buffered whole are skipped with a pointer, unconverted */
+      mark = in.cursor - 1;                                                                  /* mark: the current byte, which starts a sample */
+      for (next = mark + 1; in.end - next > 64; next += 64) {           /* Count where samples start, 64 bytes at a time, while many are left */
+        for (i = 0, starts = 0, other = 0; i < 64; i++) {                                  /* Compares, which are vectorized unlike the table */
+          white = next[i] == ' ' || next[i] == '\t' || next[i] == '\n';
+          starts += ((unsigned) (next[i] - '0') < 10u) & (next[i - 1] == ' ' || next[i - 1] == '\t' || next[i - 1] == '\n');
+          other |= (unsigned) (next[i] - '0') >= 10u && !white;
+        }
+        if (other || n + starts >= count) break;                                           /* The last samples and the errors are found below */
+        if (starts > 0) {
+          for (mark = next + 63; !is_digit(*mark) || token_class[mark[-1]] != WHITE; mark--);                  /* The last sample that starts */
+          n += starts;
+        }
+      }
+      next = mark;
+      while (n < count) {
+        while (next < in.end && is_digit(*next)) next++;
+        if (next == mark || next == in.end || token_class[*next] != WHITE) break;
+        do {
+          next++;                                                                                                 /* Skip the whole white run */
+        } while (next < in.end && token_class[*next] == WHITE);
+        if (next == in.end) break;                                                   /* The byte after the white run must be buffered as well */
+        mark = next;
+        n++;
+      }
+      in.cursor = (unsigned char *) mark + 1;
+      *pch = *mark;
+      if (n == count) break;
+    }
+    if (*pch == EOF || !is_digit(*pch)) return ERROR;                                /* Else skip one sample at a time, to find what is wrong */
+    do {
+      *pch = get_byte();
+    } while (*pch != EOF && is_digit(*pch));
+    n++;
+    if (white_space(pch) != OK && (!last || n != count)) return ERROR;                           /* Only the last sample may lack white space */
+  }
+  return OK;
+}
+
+const unsigned char *shift_bits(const unsigned char *bits, int offset, int count) {
+  static _Thread_local unsigned char shifted[ROW_CHUNK / 8];
+  int bytes = (offset + count + 7) / 8, i;                                                                                    /* of the input */
+  for (i = 0; i < (count + 7) / 8; i++) shifted[i] = bits[i] << offset | ((i + 1 < bytes) ? bits[i + 1] >> (8 - offset) : 0);
+  return shifted;
+}
+
+int check_files(int count, char *paths[]) {
+  int i, valid = 0;
+  long error;
+  if (count == 0) {                                                                                          /* The standard input is checked */
+    map_input(STDIN_FILENO);
+    if (check_frame(&error) == OK) printf("OK\n");
+    else printf("Input error at byte %ld\n", error);
+    return (error < 0) ? OK : ERROR;
+  }
+  for (i = 0; i < count; i++) {                                                                         /* Else every file is checked in turn */
+    in.data = in.cursor = in.end = input_data;                                                             /* Start over with an empty buffer */
+    in.size = BUFFER_SIZE;
+    in.fd = -1;
+    consumed = 0;
+    printf("%s: ", paths[i]);
+    if (open_input(paths[i]) != OK) printf("Cannot open input file\n");
+    else if (check_frame(&error) == OK) {
+      printf("OK\n");
+      valid++;
+    }
+    else printf("Input error at byte %ld\n", error);
+    if (in.fd >= 0) close(in.fd);
+    if (in.data != input_data) munmap(in.data, in.size);                                                    /* The image was mapped to memory */
+  }
+  printf("%d of %d images are valid.\n", valid, count);
+  return (valid == count) ? OK : ERROR;
+}
+
+int check_frame(long *error) {
+  int ch, magic, width, height, max, samples, status;
+  long count;
+  HEADER header;
+  do {                                                                                  /* Every image of a stream is checked, like converted */
+    max = 1;
+    status = ERROR;
+    *error = -1;
+    ch = get_byte();
+    magic = (ch == 'P') ? (ch = get_byte()) : EOF;
+    if ((magic >= BnW_ASCII && magic <= COLOR_BINARY) || tupled(magic)) ch = get_byte();
+    if (tupled(magic) && get_header(&ch, magic, &header) == OK) {                /* Tuples of PAM are checked like P5, and any float is valid */
+      count = (long) header.depth * header.width * header.height;
+      if (magic != PAM) status = skip_bytes(&ch, 4 * count);
+      else if (header.max == 255 || header.max == MAX_VALUE) status = skip_bytes(&ch, (header.max > 255) ? 2 * count : count);
+      else status = check_bytes(&ch, count, header.max, error);
+    }
+    else if (magic >= BnW_ASCII && magic <= COLOR_BINARY && white_space_or_comment(&ch) == OK && (width = get_integer(&ch)) != ERROR
+        && white_space(&ch) == OK && (height = get_integer(&ch)) != ERROR                                /* The same header as the converters */
+        && (depth(magic) == 1 || (white_space(&ch) == OK && (max = get_integer(&ch)) != ERROR && max <= MAX_VALUE))
+        && ((magic >= BnW_BINARY) ? single_white_character(&ch) : white_space(&ch)) == OK) {
+      samples = (depth(magic) == 3) ? 3 : 1;
+      count = (magic == BnW_BINARY) ? (width + 7) / 8 * (long) height : (long) samples * width * height;
+      if (magic == BnW_BINARY || (magic >= BnW_BINARY && (max == 255 || max == MAX_VALUE))) {             /* Every byte is valid, so only the */
+        status = skip_bytes(&ch, (max > 255) ? 2 * count : count);                                 /* length is checked, without reading them */
+      }
+      else if (magic >= BnW_BINARY) status = check_bytes(&ch, count, max, error);
+      else status = check_samples(&ch, count, max, error);
+    }
+    if (status != OK) {
+      if (*error < 0) *error = input_offset(ch);                                                      /* Where the parser stopped, by default */
+      return ERROR;
+    }
+    unget_byte(ch);                                                                        /* The byte after the image may start the next one */
+  } while (next_frame() == OK);                                                                         /* Anything after an image is ignored */
+  return OK;
+}
+
+int check_bytes(int *pch, long count, int max, long *error) {
+  const unsigned char *start;
+  long n, i;
+  int size = (max > 255) ? 2 : 1, value;
+  while (count > 0) {
+    if (*pch == EOF) break;                                                                                       /* EOF sooner than expected */
+    start = in.cursor - 1;                                                                      /* The current byte (*pch) starts the samples */
+    n = min(in.end - start, count) / size;                                                                   /* The samples that are buffered */
+    if (n > 0) {
+      if (valid_samples(start, n, max) != OK) {                                             /* Only then are they read one at a time, to find */
+        for (i = 0; ((size == 2) ? start[2 * i] << 8 | start[2 * i + 1] : start[i]) <= max; i++);                 /* the first invalid sample */
+        *error = consumed + (start - in.data) + size * i;
+        return ERROR;
+      }
+      in.cursor = (unsigned char *) start + size * n;
+      count -= n;
+      *pch = get_byte();
+    }
+    else {                                                                                   /* Else a sample of 2 bytes is split by a refill */
+      *error = input_offset(*pch);
+      value = *pch << 8;
+      *pch = get_byte();
+      if (*pch == EOF) break;
+      value |= *pch;
+      if (value > max) return ERROR;
+      count--;
+      *pch = get_byte();
+      *error = -1;
+    }
+  }
+  if (count == 0) return OK;
+  *error = input_offset(EOF);
+  return ERROR;
+}
+
+int check_samples(int *pch, long count, int max, long *error) {
+  static _Thread_local unsigned char samples[ROW_CHUNK];
+  long n;
+  int got, value;
+  for (n = 0; n < count; n += got) {
+    got = get_samples(pch, samples, min(count - n, ROW_CHUNK), 1, max);                                      /* Tokenize many samples at once */
+    if (got == 0) {                                                              /* Else tokenize one sample at a time, to find what is wrong */
+      *error = input_offset(*pch);
+      value = get_integer(pch);
+      if (value == ERROR || value > max) return ERROR;
+      *error = input_offset(*pch);
+      if (white_space(pch) != OK && n != count - 1) return ERROR;                                /* Only the last sample may lack white space */
+      *error = -1;
+      got = 1;
+    }
+  }
+  return OK;
+}
+
+long input_offset(int ch) {
+  return consumed + (in.cursor - in.data) - (ch != EOF);                                     /* The current byte (ch) was got already, if any */
+}
+
+int start_shrink(int width) {
+  if (scale == 1) return OK;                                                                                             /* Nothing is shrunk */
+  if (shrink.sums == NULL || shrink.width < width) {
+    end_shrink();
+    shrink.sums = calloc(3 * (size_t) width + 1, sizeof(unsigned int));                               /* Up to 3 samples in each output pixel */
+    if (shrink.sums == NULL) return ERROR;
+    shrink.width = width;
+  }
+  else memset(shrink.sums, 0, 3 * (size_t) width * sizeof(unsigned int));
+  return OK;
+}
+
+void end_shrink(void) {
+  free(shrink.sums);
+  shrink.sums = NULL;
+}
+
+int start_levels(int magic, int target, int max) {
+  static const double weight[2][3] = {{0.299, 0.587, 0.114}, {0.2126, 0.7152, 0.0722}};                           /* Of each method, by color */
+  int last = (maxval > 0 && depth(target) > 1) ? maxval : max, sample, color, i;                                 /* The max of output samples */
+  double part, next;                                                                   /* next: the light where the next output sample starts */
+  levels.max = max;
+  levels.last = last;
+  levels.shift = (luminance == NETPBM_LUMA) ? 0 : 8;
+  if (depth(magic) == 3 && depth(target) < 3 && (luminance != NETPBM_LUMA || (maxval > 0 && depth(target) > 1))) {        /* -m always rounds */
+    levels.weights = malloc(3 * ((size_t) max + 1) * sizeof(unsigned int));
+    if (levels.shift != 0) levels.encode = malloc(65537 * sizeof(unsigned short));
+    else if (max <= 255) levels.encode = malloc((1000 * (size_t) max + 1) * sizeof(unsigned short));            /* Luma of 2 bytes is divided */
+    if (levels.weights == NULL || (levels.encode == NULL && (levels.shift != 0 || max <= 255))) return ERROR;
+    for (sample = 0; sample <= max; sample++) {               /* The sum of the parts of a pixel is at most 2^24 + 2, so it needs no division */
+      part = light((max > 0) ? (double) sample / max : 0, luminance) * (1 << 24);
+      for (color = 0; color < 3; color++) {                           /* Luma is summed exactly, in thousandths of a sample, as in its kernel */
+        if (levels.shift == 0) levels.weights[color * (max + 1) + sample] = (int) (weight[0][color] * 1000 + 0.5) * sample;
+        else levels.weights[color * (max + 1) + sample] = weight[luminance][color] * part + 0.5;
+      }
+    }
+    if (levels.shift == 0) {                      /* Its sums are at most 1000 * max, and each one is rounded only once, by a table for bytes */
+      for (i = 0; levels.encode != NULL && i <= 1000 * max; i++) levels.encode[i] = (max > 0) ? luma_level(i) : 0;
+    }
+    else {
+      for (i = 0, sample = 0, next = light(0.5 / last, luminance) * 65536; i <= 65536; i++) {        /* The gray sample of light nearest to i */
+        while (sample < last && next <= i) {
+          sample++;
+          next = light((sample + 0.5) / last, luminance) * 65536;
+        }
+        levels.encode[i] = sample;
+      }
+    }
+  }
+  else if (depth(magic) > 1 && depth(magic) == depth(target) && last != max) {
+    levels.rescale = malloc(((size_t) max + 1) * sizeof(unsigned short));
+    if (levels.rescale == NULL) return ERROR;
+    for (sample = 0; sample <= max; sample++) {
+      levels.rescale[sample] = (max > 0) ? ((long) 2 * sample * last + max) / (2 * max) : 0;                        /* Rounded to the nearest */
+    }
+  }
+  return OK;
+}
+
+void end_levels(void) {
+  free(levels.weights);
+  free(levels.encode);
+  free(levels.rescale);
+  levels.weights = NULL;
+  levels.encode = levels.rescale = NULL;
+}
+
+double light(double value, int method) {
+  double base, root = 1;
+  int i;
+  if (method == NETPBM_LUMA) return value;                                                                 /* Samples are weighed as they are */
+  if (value <= 0.04045) return value / 12.92;                                                                      /* The linear part of sRGB */
+  base = (value + 0.055) / 1.055;
+  base *= base;                                                               /* base^2.4 = base^2 * (base^2)^(1/5), without the math library */
+  for (i = 0; i < 32; i++) root -= (root * root * root * root * root - base) / (5 * root * root * root * root);        /* Newton's fifth root */
+  return base * root;
+}
+
+void weigh_samples(const unsigned char *rgb, unsigned char *gray, int count, int size, int wide) {
+  const unsigned int *red = levels.weights, *green = red + levels.max + 1, *blue = green + levels.max + 1;
+  const unsigned short *encode = levels.encode;
+  unsigned int round = (1u << levels.shift) >> 1;
+  int i, value, shift = levels.shift;
+  if (size == 1 && !wide && luminance == NETPBM_LUMA && levels.max > 0) weigh_luma(rgb, gray, count);                   /* Luma is vectorized */
+  else if (size == 1 && !wide) weigh_scalar(rgb, gray, count);                 /* Every pair of sizes has a loop of its own, without branches */
+  else if (encode == NULL) {                                                   /* Luma of 2 bytes is divided, as its table would be too large */
+    for (i = 0; i < count; i++, rgb += 6) {
+      value = luma_level(red[rgb[0] << 8 | rgb[1]] + green[rgb[2] << 8 | rgb[3]] + blue[rgb[4] << 8 | rgb[5]]);
+      if (wide) gray[2 * i] = value >> 8;
+      gray[(wide + 1) * i + wide] = value & 0xFF;
+    }
+  }
+  else if (size == 1) {
+    for (i = 0; i < count; i++, rgb += 3) {
+      value = encode[(red[rgb[0]] + green[rgb[1]] + blue[rgb[2]] + round) >> shift];
+      gray[2 * i] = value >> 8;                                                                            /* The most significant byte first */
+      gray[2 * i + 1] = value & 0xFF;
+    }
+  }
+  else if (!wide) {
+    for (i = 0; i < count; i++, rgb += 6) {
+      gray[i] = encode[(red[rgb[0] << 8 | rgb[1]] + green[rgb[2] << 8 | rgb[3]] + blue[rgb[4] << 8 | rgb[5]] + round) >> shift];
+    }
+  }
+  else {
+    for (i = 0; i < count; i++, rgb += 6) {
+      value = encode[(red[rgb[0] << 8 | rgb[1]] + green[rgb[2] << 8 | rgb[3]] + blue[rgb[4] << 8 | rgb[5]] + round) >> shift];
+      gray[2 * i] = value >> 8;
+      gray[2 * i + 1] = value & 0xFF;
+    }
+  }
+}
+
+void weigh_scalar(const unsigned char *rgb, unsigned char *gray, int count) {
+  const unsigned int *red = levels.weights, *green = red + levels.max + 1, *blue = green + levels.max + 1;
+  unsigned int round = (1u << levels.shift) >> 1;
+  int i, shift = levels.shift;
+  for (i = 0; i < count; i++, rgb += 3) gray[i] = levels.encode[(red[rgb[0]] + green[rgb[1]] + blue[rgb[2]] + round) >> shift];
+}
+
+void rescale_samples(const unsigned char *samples, unsigned char *output, int count, int size, int wide) {
+  const unsigned short *rescale = levels.rescale;
+  int i, value;
+  if (size == 1 && !wide) for (i = 0; i < count; i++) output[i] = rescale[samples[i]];                        /* Like weigh_samples, by sizes */
+  else if (size == 1) {
+    for (i = 0; i < count; i++) {
+      value = rescale[samples[i]];
+      output[2 * i] = value >> 8;                                                                          /* The most significant byte first */
+      output[2 * i + 1] = value & 0xFF;
+    }
+  }
+  else if (!wide) for (i = 0; i < count; i++) output[i] = rescale[samples[2 * i] << 8 | samples[2 * i + 1]];
+  else {
+    for (i = 0; i < count; i++) {
+      value = rescale[samples[2 * i] << 8 | samples[2 * i + 1]];
+      output[2 * i] = value >> 8;
+      output[2 * i + 1] = value & 0xFF;
+    }
+  }
+}
+
+void put_levels(const unsigned char *samples, long count, int kind) {
+  static _Thread_local unsigned char mapped[6 * ROW_CHUNK];
+  int size = (levels.max > 255) ? 2 : 1, wide = levels.last > 255, group = (depth(kind) == 3) ? 3 : 1, chunk;    /* group: samples of a pixel */
+  int unit = group * (wide + 1), binary = kind >= BnW_BINARY;                                                /* unit: output bytes of a pixel */
+  unsigned char *output;
+  int phase = enter_phase(RUNNING_KERNELS);
+  if (!tables_ready) init_tables();                                                                            /* for the decimals of samples */
+  while (count > 0) {
+    if (binary && out.end - out.cursor < unit) flush_output();
+    chunk = binary ? min(min(count, ROW_CHUNK), (out.end - out.cursor) / unit) : min(count, ROW_CHUNK);
+    output = binary ? out.cursor : mapped;                                           /* Binary samples go straight into the free output space */
+    if (levels.weights != NULL) {                                                                               /* Color becomes gray by them */
+      weigh_samples(samples, output, chunk, size, wide);
+      samples += 3 * size * chunk;
+    }
+    else {                                                                                            /* or the samples only change their max */
+      rescale_samples(samples, output, group * chunk, size, wide);
+      samples += group * size * chunk;
+    }
+    if (histogram.active) count_pixels(output, kind, kind, chunk, wide);                      /* The samples are counted at the max of output */
+    if (binary) out.cursor += (long) unit * chunk;
+    else if (wide) put_decimals_wide(mapped, group * chunk);
+    else put_decimals(mapped, group * chunk);
+    count -= chunk;
+  }
+  enter_phase(phase);
+}
+
+int gray_sample(int red, int green, int blue) {
+  const unsigned int *weights = levels.weights, round = (1u << levels.shift) >> 1;
+  if (weights == NULL) return (299 * red + 587 * green + 114 * blue) / 1000;                                             /* Luminosity method */
+  if (levels.encode == NULL) return luma_level(weights[red] + weights[levels.max + 1 + green] + weights[2 * (levels.max + 1) + blue]);
+  return levels.encode[(weights[red] + weights[levels.max + 1 + green] + weights[2 * (levels.max + 1) + blue] + round) >> levels.shift];
+}
+
+void add_boxes(const unsigned char *pixels, int magic, int count, int max, int x) {
+  int group = (depth(magic) == 3) ? 3 : 1, left = scale - x % scale, i, c;                          /* left: pixels until the next box starts */
+  unsigned int *sums = shrink.sums + x / scale * group;
+  int phase = enter_phase(RUNNING_KERNELS);
+  if (magic == BnW_BINARY) {                                                                            /* BnW boxes count their black pixels */
+    for (i = 0; i < count; i++) {
+      *sums += pixels[i / 8] >> (7 - i % 8) & 1;
+      if (--left == 0) {
+        sums++;
+        left = scale;
+      }
+    }
+  }
+  else if (max > 255) {                                                                                    /* The most significant byte first */
+    for (i = 0; i < count; i++, pixels += 2 * group) {
+      for (c = 0; c < group; c++) sums[c] += pixels[2 * c] << 8 | pixels[2 * c + 1];
+      if (--left == 0) {
+        sums += group;
+        left = scale;
+      }
+    }
+  }
+  else {                                                                                              /* BnW in ASCII has 0 or 1 per byte too */
+    for (i = 0; i < count; i++, pixels += group) {
+      for (c = 0; c < group; c++) sums[c] += pixels[c];
+      if (--left == 0) {
+        sums += group;
+        left = scale;
+      }
+    }
+  }
+  enter_phase(phase);
+}
+
+void put_boxes(int magic, int target, int width, int lines, int max, int y) {
+  static _Thread_local unsigned char averages[6 * ROW_CHUNK];                                            /* The pixels of a chunk of the line */
+  int group = (depth(magic) == 3) ? 3 : 1, columns = shrunk(width), x, i, c, count;
+  unsigned int *sums = shrink.sums, pixels, average;
+  for (x = 0; x < columns; x += count) {
+    count = min(columns - x, ROW_CHUNK);
+    for (i = 0; i < count; i++) {
+      pixels = (x + i == columns - 1) ? width - (columns - 1) * scale : scale;                    /* Pixels in the box, fewer in the last one */
+      pixels *= lines;
+      for (c = 0; c < group; c++, sums++) {
+        average = (*sums + pixels / 2) / pixels;                                                                    /* Rounded to the nearest */
+        *sums = 0;                                                                                        /* Empty for the next line of boxes */
+        if (max > 255) {
+          averages[2 * (group * i + c)] = average >> 8;
+          averages[2 * (group * i + c) + 1] = average & 0xFF;
+        }
+        else averages[group * i + c] = average;
+      }
+    }
+    put_pixels(averages, (depth(magic) == 1) ? BnW_ASCII : magic, target, count, max, x, y);     /* BnW averages are 0 or 1 per byte, like P1 */
+  }
+}
+
+int get_integer(int *pch) {
+  int value;
+  if (*pch >= '0' && *pch <= '9') {
+    value = *pch - '0';                                                    /* Initialize the value as the numeric part of the ASCII character */
+    *pch = get_byte();                                                                                                   /* Get the next byte */
+    while (*pch >= '0' && *pch <= '9') {                                           /* Repeat as long as the content of the pointer is numeric */
+      if (value > MAX_SIGNED_INT / 10) return ERROR;                              /* Check that "value" will not overflow if multiplied by 10 */
+      value = 10 * value + (*pch - '0');                                                                         /* Build one digit at a time */
+      *pch = get_byte();                                                                                                 /* Get the next byte */
+    }
+  return value;                                                                                                          /* Successful finish */
+ }
+ else return ERROR;                                                                                                    /* Unsuccessful finish */
+}
+
+int white_space_or_comment(int *pch) {
+  if (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                            /* Check if there is a single white character */
+    *pch = get_byte();                                                                                                   /* Get the next byte */
+    while (*pch == ' ' || *pch == '\t' || *pch == '\n' || *pch == '#') {    /* Skip every following white character or the potential comments */
+      if (*pch == '#') {                                                                                         /* Check if a comment begins */
+        while (*pch != '\n' && *pch != EOF) {                                            /* Skip every character as long as the comment lasts */
+          *pch = get_byte();                                                                                             /* Get the next byte */
+        }
+      }
+      *pch = get_byte();                                                                                                 /* Get the next byte */
+    }
+    return OK;                                                                                                           /* Successful finish */
+  }
+  else return ERROR;                                                                                                   /* Unsuccessful finish */
+}
+
+int white_space(int *pch) {
+  if (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                            /* Check if there is a single white character */
+    *pch = get_byte();                                                                                                   /* Get the next byte */
+    while (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                             /* Skip every following white character */
+      *pch = get_byte();                                                                                                 /* Get the next byte */
+    }
+    return OK;                                                                                                           /* Successful finish */
+  }
+  else return ERROR;                                                                                                   /* Unsuccessful finish */
+}
+
+int single_white_character(int *pch) {
+  if (*pch == ' ' || *pch == '\t' || *pch == '\n') {                                            /* Check if there is a single white character */
+    *pch = get_byte();                                                                                                   /* Get the next byte */
+    return OK;                                                                                                           /* Successful finish */
+  }
+  else return ERROR;                                                                                                   /* Unsuccessful finish */
+}
+
+int open_input(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return ERROR;                                                                                            /* Unsuccessful finish */
+  map_input(fd);
+  return OK;                                                                                                             /* Successful finish */
+}
+
+int map_input(int fd) {
+  struct stat info;
+  off_t offset;
+  unsigned char *map;
+  in.fd = fd;                                                                               /* By default the input is read in blocks from fd */
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) return ERROR;                                  /* Pipes and terminals cannot be mapped */
+  offset = lseek(fd, 0, SEEK_CUR);                                                         /* Part of the file may have been consumed already */
+  if (offset < 0 || offset >= info.st_size) return ERROR;
+  map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) return ERROR;
+  madvise(map, info.st_size, (crop.width > 0) ? MADV_RANDOM : MADV_SEQUENTIAL);    /* Pixels are read once from top to bottom, unless cropped */
+  in.data = map;                                                                                  /* The mapping takes the place of the block */
+  in.size = info.st_size;
+  in.cursor = map + offset;                                                                  /* The parsers advance directly over the mapping */
+  in.end = map + info.st_size;
+  in.fd = -1;                                                                             /* There is nothing to refill once the mapping ends */
+  if (stats_enabled) stats.read += info.st_size - offset;
+  close(fd);                                                                                           /* The mapping stays valid after close */
+  return OK;                                                                                                             /* Successful finish */
+}
+
+int refill_input(void) {
+  unsigned char *block;
+  ssize_t count;
+  if (in.fd == FLOATS) return refill_floats();                                     /* The raster of a PFM in memory is read a block at a time */
+  if (in.fd == STREAM) {                                                                          /* The stream API feeds the input in chunks */
+    if (!stream->ended) pass_turn();                                                    /* The caller feeds the next chunk, or ends the input */
+    if (stream->ended) return EOF;
+    consumed += in.end - in.data;
+    in.data = in.cursor = (unsigned char *) stream->chunk;
+    in.size = stream->count;
+    in.end = in.data + in.size;
+    if (stats_enabled) stats.read += in.size;
+    return *in.cursor++;
+  }
+  if (in.fd < 0) return EOF;                                                                       /* A mapped input has nothing left to read */
+  block = in.data;
+  if (in.fd == reader.fd) count = next_block(&block);                                           /* Pipelined: the block has been read already */
+  else {
+    do {
+      count = read(in.fd, in.data, in.size);                                                                  /* Read the next block of input */
+    } while (count < 0 && errno == EINTR);                                                                /* Retry if interrupted by a signal */
+  }
+  if (count <= 0) return EOF;                                                                /* No more input (or read error), like getchar() */
+  if (stats_enabled) stats.read += count;
+  consumed += in.end - in.data;                                                                          /* The previous block is left behind */
+  in.data = in.cursor = block;                                                                   /* The cursor starts over from the beginning */
+  in.end = in.data + count;
+  return *in.cursor++;                                                                                  /* Return the first byte of the block */
+}
+
+void flush_output(void) {
+  unsigned char *next;
+  long count;
+  int phase;
+  if (out.fd == STREAM) {                                                                      /* The caller of the stream API gets the block */
+    if (out.cursor == out.data) return;
+    stream->block = out.data;
+    stream->length = out.cursor - out.data;
+    if (stats_enabled) stats.written += stream->length;
+    pass_turn();                                                                         /* and hands it to its sink, while this thread waits */
+    out.cursor = out.data;
+    return;
+  }
+  if (out.fd == CALLER_BUFFER) {                                                  /* Output of the library goes into the buffer of the caller */
+    count = out.cursor - out.data;
+    if (out.data == target.staging && target.length + count <= target.capacity) {
+      memcpy(target.data + target.length, out.data, count);                                      /* Staged bytes follow the ones put directly */
+    }
+    target.length += count;                                                                /* Beyond the capacity, just count the room needed */
+    out.data = target.staging;                                              /* The kernels may need more room than is left, so stage the rest */
+    out.cursor = out.data;
+    out.end = out.data + BUFFER_SIZE;
+    out.size = BUFFER_SIZE;
+    return;
+  }
+  if (out.fd < 0) {                                                              /* Output in memory is kept, so make the buffer grow instead */
+    count = out.cursor - out.data;
+    next = malloc(2 * out.size);
+    if (next == NULL) {
+      out.lost = 1;                                                                 /* Drop the bytes so far, but keep room for the next ones */
+      out.cursor = out.data;
+      return;
+    }
+    memcpy(next, out.data, count);
+    free(out.data);
+    out.data = next;
+    out.cursor = next + count;
+    out.size *= 2;
+    out.end = out.data + out.size;
+    return;
+  }
+  phase = enter_phase(FLUSHING);
+  if (stats_enabled) stats.written += out.cursor - out.data;
+  if (spare_data != NULL && out.fd == writer.fd && out.cursor != out.data) {       /* Pipelined: hand the block to the writer, fill the spare */
+    pthread_mutex_lock(&writer.lock);
+    while (writer.block != NULL) pthread_cond_wait(&writer.changed, &writer.lock);                        /* The spare is still being written */
+    writer.block = out.data;
+    writer.count = out.cursor - out.data;
+    pthread_cond_broadcast(&writer.changed);
+    pthread_mutex_unlock(&writer.lock);
+    next = spare_data;
+    spare_data = out.data;
+    out.data = next;
+    out.end = out.data + out.size;
+  }
+  else write_block(out.fd, out.data, out.cursor - out.data);
+  out.cursor = out.data;                                                                               /* The buffer is empty and ready again */
+  enter_phase(phase);
+}
+
+void write_block(int fd, const unsigned char *block, long count) {
+  ssize_t written;
+  while (count > 0) {                                                                          /* Repeat until every buffered byte is written */
+    written = write(fd, block, count);
+    if (written < 0 && errno != EINTR) break;                                              /* Give up on a broken stream, like putchar() does */
+    if (written > 0) {                                                                                      /* Writes to pipes may be partial */
+      block += written;
+      count -= written;
+    }
+  }
+}
+
+int start_writer(void) {
+  pthread_t thread;
+  unsigned char *spare = malloc(out.size);
+  if (spare == NULL) return ERROR;
+  writer.fd = out.fd;
+  if (pthread_create(&thread, NULL, output_writer, NULL) != 0) {
+    free(spare);
+    return ERROR;
+  }
+  pthread_detach(thread);                                                                       /* It is never joined, just waited to be idle */
+  spare_data = spare;
+  atexit(finish_output);                                                                    /* Runs before flush_output(), registered earlier */
+  return OK;
+}
+
+void *output_writer(void *arg) {
+  (void) arg;
+  pthread_mutex_lock(&writer.lock);
+  while (1) {
+    while (writer.block == NULL) pthread_cond_wait(&writer.changed, &writer.lock);
+    pthread_mutex_unlock(&writer.lock);
+    write_block(writer.fd, writer.block, writer.count);                                      /* Meanwhile the converters fill the other block */
+    pthread_mutex_lock(&writer.lock);
+    writer.block = NULL;
+    pthread_cond_broadcast(&writer.changed);
+  }
+  return NULL;
+}
+
+void finish_output(void) {
+  flush_output();
+  pthread_mutex_lock(&writer.lock);
+  while (writer.block != NULL) pthread_cond_wait(&writer.changed, &writer.lock);                     /* Wait for the last block to be written */
+  pthread_mutex_unlock(&writer.lock);
+}
+
+int start_reader(void) {
+  pthread_t thread;
+  int i;
+  if (in.fd < 0) {                                                    /* A mapped input is read ahead by the kernel, as its pages are faulted */
+    if (crop.width == 0) madvise(in.data, in.size, MADV_WILLNEED);                                      /* Start reading it all now, in order */
+    return OK;
+  }
+  for (i = 0; i < READ_AHEAD; i++) {
+    reader.block[i] = malloc(in.size);
+    if (reader.block[i] == NULL) break;
+  }
+  reader.size = in.size;
+  if (i < READ_AHEAD || (reader.fd = in.fd, pthread_create(&thread, NULL, input_reader, NULL) != 0)) {
+    while (i > 0) free(reader.block[--i]);
+    reader.fd = -1;
+    return ERROR;
+  }
+  pthread_detach(thread);                                                                     /* It ends at the end of input, or with the CLI */
+  return OK;
+}
+
+void *input_reader(void *arg) {
+  unsigned char *block;
+  ssize_t count;
+  (void) arg;
+  do {
+    pthread_mutex_lock(&reader.lock);
+    while (reader.filled - reader.taken == READ_AHEAD) pthread_cond_wait(&reader.changed, &reader.lock);       /* Every block is still in use */
+    block = reader.block[reader.filled % READ_AHEAD];
+    pthread_mutex_unlock(&reader.lock);
+    do {
+      count = read(reader.fd, block, reader.size);                                             /* Meanwhile the parsers go through the others */
+    } while (count < 0 && errno == EINTR);
+    pthread_mutex_lock(&reader.lock);
+    reader.count[reader.filled % READ_AHEAD] = (count > 0) ? count : 0;
+    reader.filled++;
+    pthread_cond_broadcast(&reader.changed);
+    pthread_mutex_unlock(&reader.lock);
+  } while (count > 0);                                                                 /* The last block is empty, and marks the end of input */
+  return NULL;
+}
+
+long next_block(unsigned char **block) {
+  long count;
+  pthread_mutex_lock(&reader.lock);
+  if (reader.held) {                                                                              /* The reader may fill it again from now on */
+    reader.taken++;
+    reader.held = 0;
+    pthread_cond_broadcast(&reader.changed);
+  }
+  while (reader.filled == reader.taken) pthread_cond_wait(&reader.changed, &reader.lock);                     /* The reader is behind for now */
+  *block = reader.block[reader.taken % READ_AHEAD];
+  count = reader.count[reader.taken % READ_AHEAD];
+  reader.held = (count > 0);                                                       /* The empty last block is kept, so that every refill ends */
+  pthread_mutex_unlock(&reader.lock);
+  return count;
+}
+
+void start_stats(void) {
+  stats_enabled = 1;
+  stats_start = clock_seconds();
+  switch_phase(STARTING);
+  atexit(report_stats);                                                                         /* Reported once, whichever way the CLI exits */
+}
+
+int switch_phase(int phase) {
+  double time = clock_seconds();
+  int previous = stats.phase;
+  if (stats.since > 0) stats.seconds[previous] += time - stats.since;                                   /* Unless the thread has just started */
+  stats.phase = phase;
+  stats.since = time;
+  return previous;
+}
+
+void raster_started(int width, int height) {
+  switch_phase(PARSING_RASTER);
+  stats.pixels += width * (long) height;
+}
+
+void merge_stats(void) {
+  int phase;
+  switch_phase(stats.phase);                                                                             /* Count the current phase up to now */
+  pthread_mutex_lock(&stats_lock);
+  for (phase = 0; phase < PHASES; phase++) total_stats.seconds[phase] += stats.seconds[phase];
+  total_stats.read += stats.read;
+  total_stats.written += stats.written;
+  total_stats.pixels += stats.pixels;
+  pthread_mutex_unlock(&stats_lock);
+  memset(&stats, 0, sizeof(STATS));                                                                       /* so that nothing is counted twice */
+}
+
+void report_stats(void) {
+  struct rusage usage;
+  merge_stats();
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr, "{\"seconds\": {\"total\": %.6f, \"header\": %.6f, \"raster\": %.6f, \"kernels\": %.6f, \"flush\": %.6f}, ",
+          clock_seconds() - stats_start, total_stats.seconds[PARSING_HEADER], total_stats.seconds[PARSING_RASTER],
+          total_stats.seconds[RUNNING_KERNELS], total_stats.seconds[FLUSHING]);
+  fprintf(stderr, "\"bytes_read\": %ld, \"bytes_written\": %ld, \"pixels\": %ld, \"peak_memory_kb\": %ld}\n",
+          total_stats.read, total_stats.written, total_stats.pixels, (long) usage.ru_maxrss);                        /* In kilobytes on Linux */
+}
+
+double clock_seconds(void) {
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
+  return clock.tv_sec + clock.tv_nsec / 1e9;
+}
+
+void put_integer(int value) {
+  char digits[12];                                                                            /* Enough for the decimal digits of any integer */
+  int length = 0;
+  if (value < 0) {                                                                 /* Negative values (such as EOF) are printed like printf() */
+    put_byte('-');
+    value = -value;
+  }
+  do {
+    digits[length++] = '0' + value % 10;                                                               /* Build the digits from right to left */
+    value /= 10;
+  } while (value > 0);
+  while (length > 0) {
+    put_byte(digits[--length]);                                                                          /* Put the digits from left to right */
+  }
+}
+
+void put_string(const char *string) {
+  while (*string != '\0') {
+    put_byte(*string++);
+  }
+}
+
+int valid_samples(const unsigned char *samples, long count, int max) {
+  unsigned char largest = 0;
+  unsigned int wide, widest = 0;
+  long i;
+  if (max == 255 || max >= MAX_VALUE) return OK;                      /* Every byte (or pair of bytes) is valid, so there is nothing to check */
+  if (max > 255) {                                                                          /* Samples of 2 bytes, the most significant first */
+    for (i = 0; i < count; i++) {
+      wide = samples[2 * i] << 8 | samples[2 * i + 1];
+      widest = (wide > widest) ? wide : widest;
+    }
+    return (widest <= (unsigned int) max) ? OK : ERROR;
+  }
+  for (i = 0; i < count; i++) {
+    largest = (samples[i] > largest) ? samples[i] : largest;                                /* Branchless, so that the compiler vectorizes it */
+  }
+  return (largest <= max) ? OK : ERROR;
+}
+
+void put_luminosity(const unsigned char *rgb, long count) {
+  long space;
+  int phase = enter_phase(RUNNING_KERNELS);
+  while (count > 0) {
+    if (out.cursor == out.end) flush_output();
+    space = out.end - out.cursor;                                                              /* Convert straight into the free output space */
+    if (space > count) space = count;
+    if (space > ROW_CHUNK) space = ROW_CHUNK;
+    luminosity(rgb, out.cursor, (int) space);
+    if (histogram.active) add_histogram(out.cursor, (int) space, 0);                                   /* The gray samples are counted as put */
+    out.cursor += space;
+    rgb += 3 * space;
+    count -= space;
+  }
+  enter_phase(phase);
+}
+
+void put_luminosity_ascii(const unsigned char *rgb, int count) {
+  unsigned char gray[ROW_CHUNK];
+  int i;
+  int phase;
+  if (levels.weights != NULL) {                                                              /* Color becomes gray by the tables of -m and -l */
+    put_levels(rgb, count, GRAY_ASCII);
+    return;
+  }
+  phase = enter_phase(RUNNING_KERNELS);
+  luminosity(rgb, gray, count);
+  if (histogram.active) add_histogram(gray, count, 0);
+  for (i = 0; i < count; i++) {
+    put_integer(gray[i]);                                                                            /* Print the decimal equivalent of pixel */
+    put_byte(' ');                                                                     /* and put a space as the white space needed in output */
+  }
+  enter_phase(phase);
+}
+
+void luminosity_scalar(const unsigned char *rgb, unsigned char *gray, int count) {
+  int i;
+  for (i = 0; i < count; i++, rgb += 3) {
+    gray[i] = (299 * rgb[0] + 587 * rgb[1] + 114 * rgb[2]) / 1000;                                                       /* Luminosity method */
+  }
+}
+
+void luminosity_dispatch(const unsigned char *rgb, unsigned char *gray, int count) {
+  luminosity = luminosity_scalar;                                                                           /* The portable kernel by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) luminosity = luminosity_avx2;
+  else if (__builtin_cpu_supports("ssse3")) luminosity = luminosity_ssse3;
+#endif
+  luminosity(rgb, gray, count);                                                               /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+/* The vectorized kernels give exactly the result of the scalar one. Sum = 299R + 587G + 114B is at most 255000, and
+   Sum / 1000 = (Sum / 8) / 125, where Sum / 8 fits in 16 bits and the division by 125 is a multiplication by 33555 / 2^22 */
+#define RGB_SHUFFLES                                                                                                                           \
+  const __m128i red_0   = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);                                           \
+  const __m128i red_1   = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);                                          \
+  const __m128i red_2   = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);                                          \
+  const __m128i green_0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);                                          \
+  const __m128i green_1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);                                           \
+  const __m128i green_2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);                                          \
+  const __m128i blue_0  = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);                                          \
+  const __m128i blue_1  = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);                                          \
+  const __m128i blue_2  = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)
+#define DEINTERLEAVE(a, b, c, mask_0, mask_1, mask_2)                                                                                          \
+  _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, mask_0), _mm_shuffle_epi8(b, mask_1)), _mm_shuffle_epi8(c, mask_2))
+
+__attribute__((target("ssse3"))) void luminosity_ssse3(const unsigned char *rgb, unsigned char *gray, int count) {
+  RGB_SHUFFLES;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weights_rg = _mm_set1_epi32(587 << 16 | 299);                                           /* Pairs of weights for red and green */
+  const __m128i weights_b = _mm_set1_epi32(114);                                                           /* Pairs of weights for blue and 0 */
+  const __m128i reciprocal = _mm_set1_epi16((short) 33555);
+  __m128i a, b, c, red, green, blue, halves[2];
+  int i, half;
+  for (i = 0; i + 16 <= count; i += 16, rgb += 48) {                                                                   /* 16 pixels at a time */
+    a = _mm_loadu_si128((const __m128i *) rgb);
+    b = _mm_loadu_si128((const __m128i *) (rgb + 16));
+    c = _mm_loadu_si128((const __m128i *) (rgb + 32));
+    red = DEINTERLEAVE(a, b, c, red_0, red_1, red_2);
+    green = DEINTERLEAVE(a, b, c, green_0, green_1, green_2);
+    blue = DEINTERLEAVE(a, b, c, blue_0, blue_1, blue_2);
+    for (half = 0; half < 2; half++) {                                                                /* Widen to 16 bits, 8 pixels at a time */
+      __m128i r = half ? _mm_unpackhi_epi8(red, zero) : _mm_unpacklo_epi8(red, zero);
+      __m128i g = half ? _mm_unpackhi_epi8(green, zero) : _mm_unpacklo_epi8(green, zero);
+      __m128i bl = half ? _mm_unpackhi_epi8(blue, zero) : _mm_unpacklo_epi8(blue, zero);
+      __m128i low = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), weights_rg),
+                                  _mm_madd_epi16(_mm_unpacklo_epi16(bl, zero), weights_b));
+      __m128i high = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), weights_rg),
+                                   _mm_madd_epi16(_mm_unpackhi_epi16(bl, zero), weights_b));
+      __m128i eighths = _mm_packs_epi32(_mm_srli_epi32(low, 3), _mm_srli_epi32(high, 3));
+      halves[half] = _mm_srli_epi16(_mm_mulhi_epu16(eighths, reciprocal), 6);
+    }
+    _mm_storeu_si128((__m128i *) (gray + i), _mm_packus_epi16(halves[0], halves[1]));
+  }
+  luminosity_scalar(rgb, gray + i, count - i);                                                                        /* The remaining pixels */
+}
+
+__attribute__((target("avx2"))) void luminosity_avx2(const unsigned char *rgb, unsigned char *gray, int count) {
+  RGB_SHUFFLES;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i weights_rg = _mm256_set1_epi32(587 << 16 | 299);
+  const __m256i weights_b = _mm256_set1_epi32(114);
+  const __m256i reciprocal = _mm256_set1_epi16((short) 33555);
+  __m128i a, b, c, d, e, f;
+  __m256i red, green, blue, halves[2];
+  int i, half;
+  for (i = 0; i + 32 <= count; i += 32, rgb += 96) {                                          /* 32 pixels at a time, 16 in each 128-bit lane */
+    a = _mm_loadu_si128((const __m128i *) rgb);
+    b = _mm_loadu_si128((const __m128i *) (rgb + 16));
+    c = _mm_loadu_si128((const __m128i *) (rgb + 32));
+    d = _mm_loadu_si128((const __m128i *) (rgb + 48));
+    e = _mm_loadu_si128((const __m128i *) (rgb + 64));
+    f = _mm_loadu_si128((const __m128i *) (rgb + 80));
+    red = _mm256_set_m128i(DEINTERLEAVE(d, e, f, red_0, red_1, red_2), DEINTERLEAVE(a, b, c, red_0, red_1, red_2));
+    green = _mm256_set_m128i(DEINTERLEAVE(d, e, f, green_0, green_1, green_2), DEINTERLEAVE(a, b, c, green_0, green_1, green_2));
+    blue = _mm256_set_m128i(DEINTERLEAVE(d, e, f, blue_0, blue_1, blue_2), DEINTERLEAVE(a, b, c, blue_0, blue_1, blue_2));
+    for (half = 0; half < 2; half++) {                                    /* Every step stays inside its lane, so the pixels keep their order */
+      __m256i r = half ? _mm256_unpackhi_epi8(red, zero) : _mm256_unpacklo_epi8(red, zero);
+      __m256i g = half ? _mm256_unpackhi_epi8(green, zero) : _mm256_unpacklo_epi8(green, zero);
+      __m256i bl = half ? _mm256_unpackhi_epi8(blue, zero) : _mm256_unpacklo_epi8(blue, zero);
+      __m256i low = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), weights_rg),
+                                     _mm256_madd_epi16(_mm256_unpacklo_epi16(bl, zero), weights_b));
+      __m256i high = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), weights_rg),
+                                      _mm256_madd_epi16(_mm256_unpackhi_epi16(bl, zero), weights_b));
+      __m256i eighths = _mm256_packs_epi32(_mm256_srli_epi32(low, 3), _mm256_srli_epi32(high, 3));
+      halves[half] = _mm256_srli_epi16(_mm256_mulhi_epu16(eighths, reciprocal), 6);
+    }
+    _mm256_storeu_si256((__m256i *) (gray + i), _mm256_packus_epi16(halves[0], halves[1]));
+  }
+  luminosity_ssse3(rgb, gray + i, count - i);                                                                         /* The remaining pixels */
+}
+#endif
+
+void put_luminosity_wide(const unsigned char *rgb, long count) {
+  long space;
+  int phase = enter_phase(RUNNING_KERNELS);
+  while (count > 0) {
+    if (out.end - out.cursor < 2) flush_output();
+    space = (out.end - out.cursor) / 2;                                                   /* Every gray pixel takes 2 bytes, like its samples */
+    if (space > count) space = count;
+    if (space > ROW_CHUNK) space = ROW_CHUNK;
+    luminosity_wide(rgb, out.cursor, (int) space);
+    if (histogram.active) add_histogram(out.cursor, (int) space, 1);
+    out.cursor += 2 * space;
+    rgb += 6 * space;
+    count -= space;
+  }
+  enter_phase(phase);
+}
+
+void luminosity_wide_scalar(const unsigned char *rgb, unsigned char *gray, int count) {
+  int i, pixel;
+  for (i = 0; i < count; i++, rgb += 6) {
+    pixel = (299 * (rgb[0] << 8 | rgb[1]) + 587 * (rgb[2] << 8 | rgb[3]) + 114 * (rgb[4] << 8 | rgb[5])) / 1000;         /* Luminosity method */
+    gray[2 * i] = pixel >> 8;                                                                              /* The most significant byte first */
+    gray[2 * i + 1] = pixel & 0xFF;
+  }
+}
+
+void luminosity_wide_dispatch(const unsigned char *rgb, unsigned char *gray, int count) {
+  int color, part, k, source;
+  for (color = 0; color < 3; color++) {                         /* Byte k of 8 samples of a color, in little endian, from each 16 of 48 bytes */
+    for (part = 0; part < 3; part++) {
+      for (k = 0; k < 16; k++) {
+        source = 6 * (k / 2) + 2 * color + 1 - k % 2 - 16 * part;
+        wide_shuffle[color][part][k] = (source >= 0 && source < 16) ? source : 0x80;                                /* 0x80 gives a zero byte */
+      }
+    }
+  }
+  luminosity_wide = luminosity_wide_scalar;                                                                 /* The portable kernel by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) luminosity_wide = luminosity_wide_avx2;
+  else if (__builtin_cpu_supports("sse4.1")) luminosity_wide = luminosity_wide_sse41;
+#endif
+  luminosity_wide(rgb, gray, count);                                                          /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+/* Samples of 2 bytes are swapped to little endian while they are deinterleaved. Sum = 299R + 587G + 114B is at most 65535000,
+   so it fits in 32 bits, and Sum / 1000 = Sum * 274877907 / 2^38 for every such Sum, with products of 64 bits */
+#define WIDE_DEINTERLEAVE(a, b, c, color)                                                                                                      \
+  _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, shuffle[color][0]), _mm_shuffle_epi8(b, shuffle[color][1])),                               \
+               _mm_shuffle_epi8(c, shuffle[color][2]))
+#define WIDEN(v, half, zero) ((half) ? _mm_unpackhi_epi16(v, zero) : _mm_unpacklo_epi16(v, zero))
+#define WIDEN256(v, half, zero) ((half) ? _mm256_unpackhi_epi16(v, zero) : _mm256_unpacklo_epi16(v, zero))
+
+__attribute__((target("sse4.1"))) void luminosity_wide_sse41(const unsigned char *rgb, unsigned char *gray, int count) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i reciprocal = _mm_set1_epi32(274877907);
+  const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);             /* Back to the most significant first */
+  __m128i shuffle[3][3], a, b, c, red, green, blue, sum, halves[2];
+  int i, half, color, part;
+  for (color = 0; color < 3; color++) {
+    for (part = 0; part < 3; part++) shuffle[color][part] = _mm_loadu_si128((const __m128i *) wide_shuffle[color][part]);
+  }
+  for (i = 0; i + 8 <= count; i += 8, rgb += 48) {                                                                      /* 8 pixels at a time */
+    a = _mm_loadu_si128((const __m128i *) rgb);
+    b = _mm_loadu_si128((const __m128i *) (rgb + 16));
+    c = _mm_loadu_si128((const __m128i *) (rgb + 32));
+    red = WIDE_DEINTERLEAVE(a, b, c, 0);
+    green = WIDE_DEINTERLEAVE(a, b, c, 1);
+    blue = WIDE_DEINTERLEAVE(a, b, c, 2);
+    for (half = 0; half < 2; half++) {                                                                /* Widen to 32 bits, 4 pixels at a time */
+      sum = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(WIDEN(red, half, zero), _mm_set1_epi32(299)),
+                                        _mm_mullo_epi32(WIDEN(green, half, zero), _mm_set1_epi32(587))),
+                          _mm_mullo_epi32(WIDEN(blue, half, zero), _mm_set1_epi32(114)));
+      halves[half] = _mm_or_si128(_mm_srli_epi64(_mm_mul_epu32(sum, reciprocal), 38),                                      /* Pixels 0 and 2, */
+                                  _mm_slli_epi64(_mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(sum, 32), reciprocal), 38), 32));     /* 1 and 3 */
+    }
+    _mm_storeu_si128((__m128i *) (gray + 2 * i), _mm_shuffle_epi8(_mm_packus_epi32(halves[0], halves[1]), swap));
+  }
+  luminosity_wide_scalar(rgb, gray + 2 * i, count - i);                                                               /* The remaining pixels */
+}
+
+__attribute__((target("avx2"))) void luminosity_wide_avx2(const unsigned char *rgb, unsigned char *gray, int count) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i reciprocal = _mm256_set1_epi32(274877907);
+  const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  __m128i shuffle[3][3], a, b, c, d, e, f;
+  __m256i red, green, blue, sum, halves[2];
+  int i, half, color, part;
+  for (color = 0; color < 3; color++) {
+    for (part = 0; part < 3; part++) shuffle[color][part] = _mm_loadu_si128((const __m128i *) wide_shuffle[color][part]);
+  }
+  for (i = 0; i + 16 <= count; i += 16, rgb += 96) {                                           /* 16 pixels at a time, 8 in each 128-bit lane */
+    a = _mm_loadu_si128((const __m128i *) rgb);
+    b = _mm_loadu_si128((const __m128i *) (rgb + 16));
+    c = _mm_loadu_si128((const __m128i *) (rgb + 32));
+    d = _mm_loadu_si128((const __m128i *) (rgb + 48));
+    e = _mm_loadu_si128((const __m128i *) (rgb + 64));
+    f = _mm_loadu_si128((const __m128i *) (rgb + 80));
+    red = _mm256_set_m128i(WIDE_DEINTERLEAVE(d, e, f, 0), WIDE_DEINTERLEAVE(a, b, c, 0));
+    green = _mm256_set_m128i(WIDE_DEINTERLEAVE(d, e, f, 1), WIDE_DEINTERLEAVE(a, b, c, 1));
+    blue = _mm256_set_m128i(WIDE_DEINTERLEAVE(d, e, f, 2), WIDE_DEINTERLEAVE(a, b, c, 2));
+    for (half = 0; half < 2; half++) {                                    /* Every step stays inside its lane, so the pixels keep their order */
+      sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(WIDEN256(red, half, zero), _mm256_set1_epi32(299)),
+                                              _mm256_mullo_epi32(WIDEN256(green, half, zero), _mm256_set1_epi32(587))),
+                             _mm256_mullo_epi32(WIDEN256(blue, half, zero), _mm256_set1_epi32(114)));
+      halves[half] = _mm256_or_si256(_mm256_srli_epi64(_mm256_mul_epu32(sum, reciprocal), 38),
+                                     _mm256_slli_epi64(_mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(sum, 32), reciprocal), 38), 32));
+    }
+    _mm256_storeu_si256((__m256i *) (gray + 2 * i), _mm256_shuffle_epi8(_mm256_packus_epi32(halves[0], halves[1]), swap));
+  }
+  luminosity_wide_sse41(rgb, gray + 2 * i, count - i);                                                                /* The remaining pixels */
+}
+#endif
+
+void weigh_luma_dispatch(const unsigned char *rgb, unsigned char *gray, int count) {
+  weigh_luma = weigh_scalar;                                                                        /* The lookups of every method by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) weigh_luma = weigh_luma_avx2;
+#endif
+  weigh_luma(rgb, gray, count);                                                               /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+/* The kernel gives exactly the lookups of weigh_scalar. The sum of thousandths of a pixel takes a madd, and its gray sample, rounded from
+   sum * last / (1000 * max), is (2 * sum * last + 1000 * max) / (2000 * max). That dividend is below 2^27, so it is divided by a multiply and
+   a shift, with a magic number of 28 bits as by Granlund and Montgomery, which is exact for every dividend of 27 bits */
+__attribute__((target("avx2"))) void weigh_luma_avx2(const unsigned char *rgb, unsigned char *gray, int count) {
+  RGB_SHUFFLES;
+  const __m256i zero = _mm256_setzero_si256();
+  const unsigned int *parts = levels.weights;
+  long long divisor = 2000LL * levels.max;
+  __m128i a, b, c, d, e, f, shift;
+  __m256i red, green, blue, parts_rg, parts_b, twice_last, half_divisor, magic, halves[2], quarters[2];
+  int i, half, quarter, bits = 0;
+  if (count <= 0) return;                                                                /* There are no tables yet when the kernel is chosen */
+  while ((1LL << bits) < divisor) bits++;
+  parts_rg = _mm256_set1_epi32(parts[levels.max + 2] << 16 | parts[1]);                          /* Pairs of the parts of 1 for red and green */
+  parts_b = _mm256_set1_epi32(parts[2 * levels.max + 3]);                                                               /* and for blue and 0 */
+  twice_last = _mm256_set1_epi32(2 * levels.last);
+  half_divisor = _mm256_set1_epi32(1000 * levels.max);
+  magic = _mm256_set1_epi32((int) ((1LL << (27 + bits)) / divisor + 1));
+  shift = _mm_cvtsi32_si128(27 + bits - 32);                                                      /* The product is shifted by 32 bits before */
+  for (i = 0; i + 32 <= count; i += 32, rgb += 96) {                                          /* 32 pixels at a time, 16 in each 128-bit lane */
+    a = _mm_loadu_si128((const __m128i *) rgb);
+    b = _mm_loadu_si128((const __m128i *) (rgb + 16));
+    c = _mm_loadu_si128((const __m128i *) (rgb + 32));
+    d = _mm_loadu_si128((const __m128i *) (rgb + 48));
+    e = _mm_loadu_si128((const __m128i *) (rgb + 64));
+    f = _mm_loadu_si128((const __m128i *) (rgb + 80));
+    red = _mm256_set_m128i(DEINTERLEAVE(d, e, f, red_0, red_1, red_2), DEINTERLEAVE(a, b, c, red_0, red_1, red_2));
+    green = _mm256_set_m128i(DEINTERLEAVE(d, e, f, green_0, green_1, green_2), DEINTERLEAVE(a, b, c, green_0, green_1, green_2));
+    blue = _mm256_set_m128i(DEINTERLEAVE(d, e, f, blue_0, blue_1, blue_2), DEINTERLEAVE(a, b, c, blue_0, blue_1, blue_2));
+    for (half = 0; half < 2; half++) {                                    /* Every step stays inside its lane, so the pixels keep their order */
+      __m256i r = half ? _mm256_unpackhi_epi8(red, zero) : _mm256_unpacklo_epi8(red, zero);
+      __m256i g = half ? _mm256_unpackhi_epi8(green, zero) : _mm256_unpacklo_epi8(green, zero);
+      __m256i bl = half ? _mm256_unpackhi_epi8(blue, zero) : _mm256_unpacklo_epi8(blue, zero);
+      for (quarter = 0; quarter < 2; quarter++) {
+        __m256i rg = quarter ? _mm256_unpackhi_epi16(r, g) : _mm256_unpacklo_epi16(r, g);
+        __m256i b0 = WIDEN256(bl, quarter, zero);
+        __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rg, parts_rg), _mm256_madd_epi16(b0, parts_b));
+        __m256i dividend = _mm256_add_epi32(_mm256_mullo_epi32(sum, twice_last), half_divisor);
+        __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(dividend, magic), 32);                           /* The high halves of the products */
+        __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(dividend, 32), magic);
+        quarters[quarter] = _mm256_srl_epi32(_mm256_blend_epi32(even, odd, 0xAA), shift);
+      }
+      halves[half] = _mm256_packus_epi32(quarters[0], quarters[1]);
+    }
+    _mm256_storeu_si256((__m256i *) (gray + i), _mm256_packus_epi16(halves[0], halves[1]));
+  }
+  weigh_scalar(rgb, gray + i, count - i);                                                                             /* The remaining pixels */
+}
+#endif
+
+void put_threshold(const unsigned char *gray, long count, int threshold) {
+  long space;
+  int phase = enter_phase(RUNNING_KERNELS);
+  while (count > 0) {
+    if (out.cursor == out.end) flush_output();
+    space = 8 * (out.end - out.cursor);                                                 /* Number of pixels that fit in the free output space */
+    if (space > count) space = count;
+    if (space > ROW_CHUNK) space = ROW_CHUNK;
+    threshold_pack(gray, out.cursor, (int) space, threshold);
+    out.cursor += (space + 7) / 8;
+    gray += space;
+    count -= space;
+  }
+  enter_phase(phase);
+}
+
+void threshold_scalar(const unsigned char *gray, unsigned char *bits, int count, int threshold) {
+  int i, j, pixels;
+  for (i = 0; i < count; i += 8) {
+    pixels = 0xFF;                                                                /* Reset pixels to 11111111 (due to ace padding at the end) */
+    for (j = 0; j < 8 && i + j < count; j++) {
+      if (gray[i + j] > threshold) {                                    /* Check if the color of the current output pixel should be white (0) */
+        pixels &= ~(0x80 >> j);                                                               /* If yes, then "clean" it by using an AND-mask */
+      }
+    }
+    bits[i / 8] = pixels;
+  }
+}
+
+void threshold_dispatch(const unsigned char *gray, unsigned char *bits, int count, int threshold) {
+  int mask, bit;
+  for (mask = 0; mask < 256; mask++) {                              /* Bit b of a movemask is pixel b, while pixel 0 is the msb of a BnW byte */
+    black_bits[mask] = 0;
+    for (bit = 0; bit < 8; bit++) {
+      if (!(mask & (1 << bit))) black_bits[mask] |= 0x80 >> bit;                                       /* Pixels that are not white are black */
+    }
+  }
+  threshold_pack = threshold_scalar;                                                                        /* The portable kernel by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) threshold_pack = threshold_avx2;
+  else if (__builtin_cpu_supports("sse2")) threshold_pack = threshold_sse2;
+#endif
+  threshold_pack(gray, bits, count, threshold);                                               /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+/* Bytes are compared as signed after flipping their msb, since there is no unsigned byte comparison before AVX-512 */
+__attribute__((target("sse2"))) void threshold_sse2(const unsigned char *gray, unsigned char *bits, int count, int threshold) {
+  const __m128i flip = _mm_set1_epi8((char) 0x80);
+  const __m128i limit = _mm_set1_epi8((char) (threshold ^ 0x80));
+  int i, white;
+  for (i = 0; i + 16 <= count; i += 16, bits += 2) {                                                                   /* 16 pixels at a time */
+    white = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(_mm_loadu_si128((const __m128i *) (gray + i)), flip), limit));
+    bits[0] = black_bits[white & 0xFF];
+    bits[1] = black_bits[white >> 8];
+  }
+  threshold_scalar(gray + i, bits, count - i, threshold);                                                             /* The remaining pixels */
+}
+
+__attribute__((target("avx2"))) void threshold_avx2(const unsigned char *gray, unsigned char *bits, int count, int threshold) {
+  const __m256i flip = _mm256_set1_epi8((char) 0x80);
+  const __m256i limit = _mm256_set1_epi8((char) (threshold ^ 0x80));
+  const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,           /* Reverse each group of 8 pixels, */
+                                           7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);        /* so that the first becomes the msb */
+  __m256i white;
+  unsigned int black;
+  int i;
+  for (i = 0; i + 32 <= count; i += 32, bits += 4) {                                                                   /* 32 pixels at a time */
+    white = _mm256_cmpgt_epi8(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (gray + i)), flip), limit);
+    black = ~(unsigned int) _mm256_movemask_epi8(_mm256_shuffle_epi8(white, reverse));
+    memcpy(bits, &black, 4);                                                                   /* x86 is little endian, so byte 0 comes first */
+  }
+  threshold_sse2(gray + i, bits, count - i, threshold);                                                               /* The remaining pixels */
+}
+#endif
+
+void put_threshold_wide(const unsigned char *gray, long count, int threshold) {
+  unsigned char white[ROW_CHUNK];
+  long i, chunk;
+  int phase = enter_phase(RUNNING_KERNELS);
+  while (count > 0) {
+    chunk = min(count, ROW_CHUNK);                                                                                  /* A multiple of 8 pixels */
+    for (i = 0; i < chunk; i++) {
+      white[i] = ((gray[2 * i] << 8 | gray[2 * i + 1]) > threshold) ? 255 : 0;              /* Branchless, so that the compiler vectorizes it */
+    }
+    put_threshold(white, chunk, 127);                                                                /* The kernels of 1 byte pack the result */
+    gray += 2 * chunk;
+    count -= chunk;
+  }
+  enter_phase(phase);
+}
+
+void ordered_scalar(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits) {
+  int i, j, pixels;
+  for (i = 0; i < count; i += 8) {                                               /* Every group of 8 pixels starts at a column 8k of the line */
+    pixels = 0xFF;                                                                /* Reset pixels to 11111111 (due to ace padding at the end) */
+    for (j = 0; j < 8 && i + j < count; j++) {
+      if (gray[i + j] > limits[j]) pixels &= ~(0x80 >> j);                                      /* Each column of the 8 has its own threshold */
+    }
+    bits[i / 8] = pixels;
+  }
+}
+
+void ordered_dispatch(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits) {
+  unsigned char byte = 0;
+  threshold_pack(&byte, &byte, 0, 0);                                                             /* The threshold kernels build black_bits[] */
+  ordered_pack = ordered_scalar;                                                                            /* The portable kernel by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) ordered_pack = ordered_avx2;
+  else if (__builtin_cpu_supports("sse2")) ordered_pack = ordered_sse2;
+#endif
+  ordered_pack(gray, bits, count, limits);                                                    /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+/* Like the threshold kernels, but the thresholds of the 8 columns repeat along the vector instead of a single one */
+__attribute__((target("sse2"))) void ordered_sse2(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits) {
+  const __m128i flip = _mm_set1_epi8((char) 0x80);
+  const __m128i pattern = _mm_loadl_epi64((const __m128i *) limits);                                                     /* The 8 thresholds, */
+  const __m128i limit = _mm_xor_si128(_mm_unpacklo_epi64(pattern, pattern), flip);                                                   /* twice */
+  int i, white;
+  for (i = 0; i + 16 <= count; i += 16, bits += 2) {                                                                   /* 16 pixels at a time */
+    white = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(_mm_loadu_si128((const __m128i *) (gray + i)), flip), limit));
+    bits[0] = black_bits[white & 0xFF];
+    bits[1] = black_bits[white >> 8];
+  }
+  ordered_scalar(gray + i, bits, count - i, limits);                                                                  /* The remaining pixels */
+}
+
+__attribute__((target("avx2"))) void ordered_avx2(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits) {
+  const __m256i flip = _mm256_set1_epi8((char) 0x80);
+  const __m256i limit = _mm256_xor_si256(_mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) limits)), flip);
+  const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,           /* Reverse each group of 8 pixels, */
+                                           7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);        /* so that the first becomes the msb */
+  __m256i white;
+  unsigned int black;
+  int i;
+  for (i = 0; i + 32 <= count; i += 32, bits += 4) {                                                                   /* 32 pixels at a time */
+    white = _mm256_cmpgt_epi8(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (gray + i)), flip), limit);
+    black = ~(unsigned int) _mm256_movemask_epi8(_mm256_shuffle_epi8(white, reverse));
+    memcpy(bits, &black, 4);                                                                   /* x86 is little endian, so byte 0 comes first */
+  }
+  ordered_sse2(gray + i, bits, count - i, limits);                                                                    /* The remaining pixels */
+}
+#endif
+
+void drop_samples_scalar(const unsigned char *samples, unsigned char *pixels, int count, int stride, int kept) {
+  int i, j;
+  for (i = 0; i < count; i++, samples += stride, pixels += kept) {
+    for (j = 0; j < kept; j++) pixels[j] = samples[j];
+  }
+}
+
+void drop_samples_dispatch(const unsigned char *samples, unsigned char *pixels, int count, int stride, int kept) {
+  drop_samples = drop_samples_scalar;                                                                       /* The portable kernel by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) drop_samples = drop_samples_ssse3;
+#endif
+  drop_samples(samples, pixels, count, stride, kept);                                         /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+/* RGB with alpha keeps 12 of every 16 bytes, which are stored with 4 more: the next store writes over them, or they are past the pixels */
+__attribute__((target("ssse3"))) void drop_samples_ssse3(const unsigned char *samples, unsigned char *pixels, int count, int stride, int kept) {
+  const __m128i rgb = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m128i low = _mm_set1_epi16(0xFF);
+  __m128i a, b;
+  int i = 0;
+  if (stride == 4 && kept == 3) {
+    for (; i + 4 <= count; i += 4) {                                                                                    /* 4 pixels at a time */
+      _mm_storeu_si128((__m128i *) (pixels + 3 * i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (samples + 4 * i)), rgb));
+    }
+  }
+  else if (stride == 2 && kept == 1) {                                                     /* Gray with alpha keeps the low byte of each pair */
+    for (; i + 16 <= count; i += 16) {                                                                                 /* 16 pixels at a time */
+      a = _mm_and_si128(_mm_loadu_si128((const __m128i *) (samples + 2 * i)), low);
+      b = _mm_and_si128(_mm_loadu_si128((const __m128i *) (samples + 2 * i + 16)), low);
+      _mm_storeu_si128((__m128i *) (pixels + i), _mm_packus_epi16(a, b));
+    }
+  }
+  drop_samples_scalar(samples + stride * i, pixels + kept * i, count - i, stride, kept);                              /* The remaining pixels */
+}
+#endif
+
+void float_samples_scalar(const unsigned char *floats, unsigned char *samples, long count, int max, int little) {
+  unsigned int bits;
+  float value;
+  long i;
+  for (i = 0; i < count; i++, floats += 4) {
+    bits = little ? (unsigned int) floats[3] << 24 | floats[2] << 16 | floats[1] << 8 | floats[0]
+                  : (unsigned int) floats[0] << 24 | floats[1] << 16 | floats[2] << 8 | floats[3];
+    memcpy(&value, &bits, sizeof(value));
+    value = value * max + 0.5f;                                                                           /* 0 to 1 becomes 0 to max, rounded */
+    value = (value > 0) ? value : 0;                                                                      /* Below 0 is black, and so is NaN, */
+    value = (value < max) ? value : max;                                                                              /* and above 1 is white */
+    if (max > 255) {
+      samples[2 * i] = (int) value >> 8;                                                                   /* The most significant byte first */
+      samples[2 * i + 1] = (int) value & 0xFF;
+    }
+    else samples[i] = (int) value;
+  }
+}
+
+void float_samples_dispatch(const unsigned char *floats, unsigned char *samples, long count, int max, int little) {
+  float_samples = float_samples_scalar;                                                                     /* The portable kernel by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) float_samples = float_samples_sse2;
+#endif
+  float_samples(floats, samples, count, max, little);                                         /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+/* The steps of the scalar kernel, with its result. MAXPS gives its second operand if either is NaN, so NaN becomes 0 there too. Samples of
+   2 bytes are packed with signed saturation after subtracting 32768, which is added back by flipping the msb of every word */
+__attribute__((target("sse2"))) void float_samples_sse2(const unsigned char *floats, unsigned char *samples, long count, int max, int little) {
+  const __m128 zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f), limit = _mm_set1_ps((float) max);
+  const __m128i bias = _mm_set1_epi32(32768), flip = _mm_set1_epi16((short) 0x8000);
+  __m128i part[4], words;
+  long i;
+  int j;
+  for (i = 0; i + 16 <= count; i += 16, floats += 64) {                                                               /* 16 samples at a time */
+    for (j = 0; j < 4; j++) {
+      part[j] = _mm_loadu_si128((const __m128i *) (floats + 16 * j));
+      if (!little) {                                                         /* Reverse the bytes of each float: in each word, then the words */
+        part[j] = _mm_or_si128(_mm_slli_epi16(part[j], 8), _mm_srli_epi16(part[j], 8));
+        part[j] = _mm_shufflehi_epi16(_mm_shufflelo_epi16(part[j], 0xB1), 0xB1);
+      }
+      part[j] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_castsi128_ps(part[j]), limit), half), zero), limit));
+    }
+    if (max > 255) {
+      for (j = 0; j < 4; j += 2) {
+        words = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(part[j], bias), _mm_sub_epi32(part[j + 1], bias)), flip);
+        _mm_storeu_si128((__m128i *) (samples + 2 * i + 8 * j), _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8)));
+      }
+    }
+    else _mm_storeu_si128((__m128i *) (samples + i), _mm_packus_epi16(_mm_packs_epi32(part[0], part[1]), _mm_packs_epi32(part[2], part[3])));
+  }
+  float_samples_scalar(floats, samples + ((max > 255) ? 2 : 1) * i, count - i, max, little);                         /* The remaining samples */
+}
+#endif
+
+void sample_floats_scalar(const unsigned char *samples, unsigned char *floats, long count, int max) {
+  unsigned int bits;
+  float value;
+  long i;
+  for (i = 0; i < count; i++, floats += 4) {
+    value = (float) ((max > 255) ? samples[2 * i] << 8 | samples[2 * i + 1] : samples[i]) / max;
+    memcpy(&bits, &value, sizeof(bits));
+    floats[0] = bits & 0xFF;                                                                              /* The least significant byte first */
+    floats[1] = bits >> 8 & 0xFF;
+    floats[2] = bits >> 16 & 0xFF;
+    floats[3] = bits >> 24;
+  }
+}
+
+void sample_floats_dispatch(const unsigned char *samples, unsigned char *floats, long count, int max) {
+  sample_floats = sample_floats_scalar;                                                                     /* The portable kernel by default */
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) sample_floats = sample_floats_sse2;
+#endif
+  sample_floats(samples, floats, count, max);                                                 /* Later calls go straight to the chosen kernel */
+}
+
+#ifdef X86_KERNELS
+__attribute__((target("sse2"))) void sample_floats_sse2(const unsigned char *samples, unsigned char *floats, long count, int max) {
+  const __m128 limit = _mm_set1_ps((float) max);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i words;
+  long i;
+  for (i = 0; i + 8 <= count; i += 8, floats += 32) {                                                                  /* 8 samples at a time */
+    if (max > 255) {
+      words = _mm_loadu_si128((const __m128i *) (samples + 2 * i));
+      words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));                   /* The most significant byte last, like x86 */
+    }
+    else words = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (samples + i)), zero);
+    _mm_storeu_ps((float *) floats, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)), limit));         /* x86 is little endian, so */
+    _mm_storeu_ps((float *) (floats + 16), _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero)), limit));   /* floats are stored whole */
+  }
+  sample_floats_scalar(samples + ((max > 255) ? 2 : 1) * i, floats, count - i, max);                                 /* The remaining samples */
+}
+#endif
+
+int start_dither(int width) {
+  if (dither == NETPBM_OTSU) {                                                   /* Otsu's method keeps the lines, until they are all counted */
+    dithering.used = 0;
+    dithering.threshold = -1;
+    return OK;
+  }
+  if (dither != NETPBM_FLOYD_STEINBERG) return OK;                                         /* Only error diffusion keeps state between pixels */
+  if (dithering.lines == NULL || dithering.width < width) {
+    end_dither();
+    dithering.lines = calloc(2 * ((size_t) width + 2), sizeof(int));                       /* Two lines, with a pixel of margin at either end */
+    if (dithering.lines == NULL) return ERROR;
+  }
+  else memset(dithering.lines, 0, 2 * ((size_t) width + 2) * sizeof(int));
+  dithering.width = width;
+  dithering.errors = dithering.lines;
+  dithering.next = dithering.lines + width + 2;
+  dithering.line = 0;
+  return OK;
+}
+
+void end_dither(void) {
+  free(dithering.lines);
+  dithering.lines = NULL;
+  free(dithering.frame);
+  dithering.frame = NULL;
+  dithering.room = 0;
+}
+
+void keep_samples(const unsigned char *samples, long count) {
+  unsigned char *frame;
+  long room;
+  if (dithering.used + count > dithering.room) {                                                     /* The lines grow by doubling, when full */
+    room = (2 * dithering.room > dithering.used + count) ? 2 * dithering.room : dithering.used + count;
+    frame = realloc(dithering.frame, room);
+    if (frame == NULL) return;                                                                     /* put_otsu() finds that lines are missing */
+    dithering.frame = frame;
+    dithering.room = room;
+  }
+  memcpy(dithering.frame + dithering.used, samples, count);
+  dithering.used += count;
+}
+
+int put_otsu(int target, int width, int height, int max) {
+  int size = (max > 255) ? 2 : 1, x, y, count;
+  const unsigned char *row = dithering.frame;
+  if (dithering.used != (long) size * width * height) return ERROR;                               /* Memory ran out while the lines were kept */
+  dithering.threshold = otsu_threshold();
+  histogram.active = 0;                                                                                        /* The pixels are counted once */
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x += count) {
+      count = min(width - x, ROW_CHUNK);
+      put_pixels(row, GRAY_BINARY, target, count, max, x, y);                                     /* The gray samples are put at last, as BnW */
+      row += size * count;
+    }
+    if (target <= COLOR_ASCII) {
+      if (y == height - 1) trim_space();
+      put_byte('\n');
+    }
+  }
+  return OK;
+}
+
+void keep_floats(const unsigned char *samples, long count, int max) {
+  unsigned char *floats;
+  long room;
+  if (tuples.used + 4 * count > tuples.room) {                                          /* Doubled when full, like the lines of Otsu's method */
+    room = (2 * tuples.room > tuples.used + 4 * count) ? 2 * tuples.room : tuples.used + 4 * count;
+    floats = realloc(tuples.floats, room);
+    if (floats == NULL) return;                                                                  /* put_floats() finds that lines are missing */
+    tuples.floats = floats;
+    tuples.room = room;
+  }
+  sample_floats(samples, tuples.floats + tuples.used, count, max);
+  tuples.used += 4 * count;
+}
+
+int put_floats(int width, int height, int depth) {
+  long line = 4L * depth * width;
+  int y;
+  if (tuples.used != line * height) return ERROR;                                                 /* Memory ran out while the lines were kept */
+  for (y = height - 1; y >= 0; y--) put_bytes(tuples.floats + y * line, line);                                 /* The bottom line comes first */
+  return OK;
+}
+
+void end_tuples(void) {
+  free(tuples.copy);
+  free(tuples.samples);
+  free(tuples.floats);
+  tuples.copy = tuples.samples = tuples.floats = NULL;
+  tuples.raster = NULL;
+  tuples.used = tuples.room = 0;
+  tuples.depth = tuples.output = 0;                                                                    /* The next image may be of any format */
+}
+
+void start_histogram(int width, int height, int max, int active) {
+  histogram.active = active;
+  if (!active) return;
+  memset(histogram.count, 0, sizeof(histogram.count));
+  histogram.sum = 0;
+  histogram.low = max;
+  histogram.high = 0;
+  histogram.width = width;
+  histogram.height = height;
+  histogram.max = max;
+  histogram.bins = min(max + 1, 256);
+}
+
+void count_pixels(const unsigned char *pixels, int magic, int target, int count, int wide) {
+  static _Thread_local unsigned char gray[2 * ROW_CHUNK];
+  long black = 0;
+  int i, chunk;
+  if (depth(magic) == 1) {                                                              /* BnW has 2 bins: 0 for black pixels and 1 for white */
+    for (i = 0; i < count; i++) black += (magic == BnW_BINARY) ? pixels[i / 8] >> (7 - i % 8) & 1 : pixels[i];
+    histogram.count[0][0] += black;
+    histogram.count[0][1] += count - black;
+  }
+  else if (depth(target) < 3) add_histogram(pixels, count, wide);                                     /* Gray samples are counted as they are */
+  else {
+    for (i = 0; i < count; i += chunk) {                           /* Color is counted by the luminosity method of the CLI, a chunk at a time */
+      chunk = min(count - i, ROW_CHUNK);
+      if (wide) luminosity_wide(pixels + 6L * i, gray, chunk);
+      else luminosity(pixels + 3L * i, gray, chunk);
+      add_histogram(gray, chunk, wide);
+    }
+  }
+}
+
+void add_histogram(const unsigned char *samples, int count, int wide) {
+  unsigned long (*lane)[256] = histogram.count;
+  int i, value;
+  if (!wide) {                                                                    /* Equal neighbors, as in flat areas, go to different lanes */
+    for (i = 0; i + 4 <= count; i += 4) {
+      lane[0][samples[i]]++;
+      lane[1][samples[i + 1]]++;
+      lane[2][samples[i + 2]]++;
+      lane[3][samples[i + 3]]++;
+    }
+    for (; i < count; i++) lane[0][samples[i]]++;
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    value = min(samples[2 * i] << 8 | samples[2 * i + 1], histogram.max);                       /* Gray to BnW lets samples above max through */
+    lane[i % 4][value * 256L / (histogram.max + 1)]++;
+    histogram.sum += value;
+    if (value < histogram.low) histogram.low = value;
+    if (value > histogram.high) histogram.high = value;
+  }
+}
+
+void add_sample(int value) {
+  value = (value < 0) ? 0 : min(value, histogram.max);                                  /* Gray to BnW lets samples above max and EOF through */
+  if (histogram.max <= 255) {
+    histogram.count[0][value]++;
+    return;
+  }
+  histogram.count[0][value * 256L / (histogram.max + 1)]++;
+  histogram.sum += value;
+  if (value < histogram.low) histogram.low = value;
+  if (value > histogram.high) histogram.high = value;
+}
+
+void gather_histogram(HISTOGRAM *image) {
+  int lane, bin;
+  for (lane = 0; lane < 4; lane++) {
+    for (bin = 0; bin < 256; bin++) image->count[lane][bin] += histogram.count[lane][bin];
+  }
+  image->sum += histogram.sum;
+  if (histogram.low < image->low) image->low = histogram.low;
+  if (histogram.high > image->high) image->high = histogram.high;
+  start_histogram(histogram.width, histogram.height, histogram.max, histogram.active);                     /* for the next band of the thread */
+}
+
+void merge_histogram(void) {
+  int lane, bin;
+  for (lane = 1; lane < 4; lane++) {
+    for (bin = 0; bin < 256; bin++) {
+      histogram.count[0][bin] += histogram.count[lane][bin];
+      histogram.count[lane][bin] = 0;
+    }
+  }
+  for (bin = histogram.bins; bin < 256; bin++) {                      /* Samples of a byte above max, which gray to BnW lets through, are max */
+    histogram.count[0][histogram.bins - 1] += histogram.count[0][bin];
+    histogram.count[0][bin] = 0;
+  }
+  if (histogram.max > 255) return;                                                /* Samples of 2 bytes have been summed as they were counted */
+  histogram.sum = 0;
+  histogram.low = histogram.max;
+  histogram.high = 0;
+  for (bin = 0; bin < histogram.bins; bin++) {                                                        /* Else each bin is a sample of its own */
+    if (histogram.count[0][bin] == 0) continue;
+    histogram.sum += (unsigned long long) bin * histogram.count[0][bin];
+    if (bin < histogram.low) histogram.low = bin;
+    histogram.high = bin;
+  }
+}
+
+int otsu_threshold(void) {
+  const unsigned long *count = histogram.count[0];
+  double total = 0, sum = 0, below = 0, part = 0, difference, variance, best = -1;
+  int bin, threshold = 0;
+  merge_histogram();
+  for (bin = 0; bin < histogram.bins; bin++) {
+    total += count[bin];
+    sum += (double) bin * count[bin];
+  }
+  for (bin = 0; bin < histogram.bins - 1; bin++) {              /* The bins up to bin become black, and the others white: keep the best split */
+    below += count[bin];
+    part += (double) bin * count[bin];
+    if (below == 0) continue;
+    if (below == total) break;
+    difference = part / below - (sum - part) / (total - below);                                               /* of the means of both classes */
+    variance = below * (total - below) * difference * difference;                                                /* The variance between them */
+    if (variance > best) {
+      best = variance;
+      threshold = bin;
+    }
+  }
+  return ((threshold + 1) * (histogram.max + 1L) + histogram.bins - 1) / histogram.bins - 1;                 /* The largest sample of the bin */
+}
+
+void put_histogram(int image) {
+  FILE *file = (histogram_file != NULL) ? histogram_file : stderr;
+  unsigned long pixels = 0;
+  int threshold = otsu_threshold(), bin;
+  for (bin = 0; bin < histogram.bins; bin++) pixels += histogram.count[0][bin];
+  flockfile(file);                                                                           /* The line of an image is not mixed with others */
+  fprintf(file, "{\"image\": %d, \"width\": %d, \"height\": %d, \"max\": %d, \"pixels\": %lu, ", image, histogram.width, histogram.height,
+          histogram.max, pixels);
+  fprintf(file, "\"minimum\": %d, \"maximum\": %d, \"mean\": %.3f, \"threshold\": %d, \"histogram\": [", (pixels > 0) ? histogram.low : 0,
+          histogram.high, (pixels > 0) ? (double) histogram.sum / pixels : 0.0, threshold);
+  for (bin = 0; bin < histogram.bins; bin++) fprintf(file, (bin == 0) ? "%lu" : ", %lu", histogram.count[0][bin]);
+  fprintf(file, "]}\n");
+  funlockfile(file);
+}
+
+int dither_pixel(int value, int x, int y, int max) {
+  int *swap, error, white;
+  if (dither == NETPBM_BAYER) return value > (2 * bayer[y % 8][x % 8] + 1) * (max + 1) / 128;      /* The thresholds average to (max + 1) / 2 */
+  if (y != dithering.line) {                                                                  /* The next line takes the errors carried to it */
+    swap = dithering.errors;
+    dithering.errors = dithering.next;
+    dithering.next = swap;
+    memset(dithering.next, 0, (dithering.width + 2) * sizeof(int));
+    dithering.line = y;
+  }
+  value = 16 * value + dithering.errors[x + 1];
+  white = value > 16 * ((max + 1) / 2);
+  error = value - (white ? 16 * max : 0);                                                              /* What the output pixel lost or added */
+  dithering.errors[x + 2] += error * 7 / 16;                                                            /* Spread over the pixels not put yet */
+  dithering.next[x] += error * 3 / 16;
+  dithering.next[x + 1] += error * 5 / 16;
+  dithering.next[x + 2] += error / 16;
+  return white;
+}
+
+void dither_samples(const unsigned char *gray, unsigned char *white, int count, int x, int y, int max) {
+  unsigned char limits[8];
+  int i;
+  if (dither == NETPBM_BAYER && max <= 255) {
+    for (i = 0; i < 8; i++) limits[i] = (2 * bayer[y % 8][(x + i) % 8] + 1) * (max + 1) / 128;
+    for (i = 0; i < count; i++) white[i] = (gray[i] > limits[i % 8]) ? 255 : 0;             /* Branchless, so that the compiler vectorizes it */
+  }
+  else if (max <= 255) {
+    for (i = 0; i < count; i++) white[i] = dither_pixel(gray[i], x + i, y, max) ? 255 : 0;                    /* Errors go from left to right */
+  }
+  else {
+    for (i = 0; i < count; i++) white[i] = dither_pixel(gray[2 * i] << 8 | gray[2 * i + 1], x + i, y, max) ? 255 : 0;
+  }
+}
+
+void put_dithered(const unsigned char *gray, long count, int y, int max) {
+  unsigned char white[ROW_CHUNK], limits[8];
+  long space, x = 0;
+  int i, phase = enter_phase(RUNNING_KERNELS);
+  for (i = 0; i < 8; i++) limits[i] = (2 * bayer[y % 8][i] + 1) * (max + 1) / 128;                      /* The thresholds of the line, if any */
+  while (count > 0) {
+    space = min(count, ROW_CHUNK);                                                                                  /* A multiple of 8 pixels */
+    if (dither == NETPBM_BAYER && max <= 255) {                                         /* Ordered dithering is as fast as a single threshold */
+      if (out.cursor == out.end) flush_output();
+      space = min(space, 8 * (out.end - out.cursor));
+      ordered_pack(gray, out.cursor, (int) space, limits);
+      out.cursor += (space + 7) / 8;
+    }
+    else {
+      dither_samples(gray, white, (int) space, (int) x, y, max);
+      put_threshold(white, space, 127);                                                              /* The kernels of 1 byte pack the result */
+    }
+    gray += (max > 255) ? 2 * space : space;
+    x += space;
+    count -= space;
+  }
+  enter_phase(phase);
+}
+
+int get_wide(int ch) {
+  int low = get_byte();                                                                                         /* The least significant byte */
+  return (low == EOF) ? MAX_SIGNED_INT : (ch << 8 | low);                                       /* A sample cut by EOF is larger than any max */
+}
+
+int get_samples(int *pch, unsigned char *samples, int count, int group, int max) {
+  const unsigned char *next = in.cursor - 1, *end = in.end, *mark;                    /* next: the current byte (*pch), which starts a sample */
+  int n = 0, done = 0, value;                                                          /* done: the samples of the complete groups of samples */
+  if (*pch == EOF || max > 255) return 0;                                        /* Samples that do not fit in a byte are left to the callers */
+  mark = next;                                                                                    /* The first byte after the complete groups */
+  while (n < count && end - next > 4) {                            /* Up to 3 digits and a white character must be buffered, to parse quickly */
+    if (!is_digit(next[0])) break;
+    value = digit_value(next[0]);
+    next++;
+    if (is_digit(*next)) {                                              /* A table lookup per byte tells digits from white space and the rest */
+      value = 10 * value + digit_value(*next);
+      next++;
+      if (is_digit(*next)) {
+        value = 10 * value + digit_value(*next);
+        next++;
+      }
+    }
+    if (value > max || token_class[*next] != WHITE) break;              /* More digits, larger values and other bytes are left to get_integer */
+    do {
+      next++;                                                                                                     /* Skip the whole white run */
+    } while (next < end && token_class[*next] == WHITE);
+    if (next == end) break;                                                          /* The byte after the white run must be buffered as well */
+    samples[n++] = value;
+    if (n % group == 0) {                                                              /* Only complete groups (such as RGB pixels) are taken */
+      done = n;
+      mark = next;
+    }
+  }
+  in.cursor = (unsigned char *) mark + 1;                                                     /* Continue right after the last complete group */
+  *pch = *mark;
+  return done;                                                                                             /* The number of tokenized samples */
+}
+
+void put_bytes(const unsigned char *bytes, long count) {
+  long space;
+  while (count > 0) {
+    if (out.cursor == out.end) flush_output();
+    space = min(out.end - out.cursor, count);
+    memcpy(out.cursor, bytes, space);
+    out.cursor += space;
+    bytes += space;
+    count -= space;
+  }
+}
+
+void init_tables(void) {
+  int value, bit;
+  char text[8];
+  for (value = 0; value < 256; value++) {
+    sprintf(text, "%d ", value);
+    memcpy(decimal[value], text, 4);                                                        /* At most 3 digits and a space, without the '\0' */
+    for (bit = 0; bit < 8; bit++) {
+      bits_ascii[value][2 * bit] = (value & (0x80 >> bit)) ? '1' : '0';                             /* The msb is the first pixel of the byte */
+      bits_ascii[value][2 * bit + 1] = ' ';                                                /* Put a space as the white space needed in output */
+    }
+  }
+  tables_ready = 1;
+}
+
+void put_decimals(const unsigned char *samples, long count) {
+  long i, chunk;
+  int phase = enter_phase(RUNNING_KERNELS);
+  while (count > 0) {
+    chunk = min(count, ROW_CHUNK);
+    if (out.end - out.cursor < 4 * chunk) flush_output();                         /* Every sample takes at most 4 bytes, so make room at once */
+    for (i = 0; i < chunk; i++) {
+      memcpy(out.cursor, decimal[samples[i]], 4);                                   /* Copy all 4 bytes, since fixed size copies need no loop */
+      out.cursor += 2 + (samples[i] >= 10) + (samples[i] >= 100);                                   /* but keep only the digits and the space */
+    }
+    samples += chunk;
+    count -= chunk;
+  }
+  enter_phase(phase);
+}
+
+void put_decimals_wide(const unsigned char *samples, long count) {
+  long i, chunk;
+  unsigned int value, length, digit;
+  int phase = enter_phase(RUNNING_KERNELS);
+  while (count > 0) {
+    chunk = min(count, ROW_CHUNK);
+    if (out.end - out.cursor < 6 * chunk) flush_output();                         /* Every sample takes at most 6 bytes, so make room at once */
+    for (i = 0; i < chunk; i++) {
+      value = samples[2 * i] << 8 | samples[2 * i + 1];
+      length = 1 + (value >= 10) + (value >= 100) + (value >= 1000) + (value >= 10000);
+      for (digit = length; digit > 0; digit--) {                                                     /* The digits from the least significant */
+        out.cursor[digit - 1] = '0' + value % 10;
+        value /= 10;
+      }
+      out.cursor[length] = ' ';
+      out.cursor += length + 1;
+    }
+    samples += 2 * chunk;
+    count -= chunk;
+  }
+  enter_phase(phase);
+}
+
+void put_bits_ascii(const unsigned char *bytes, long count) {
+  long i, chunk;
+  int phase = enter_phase(RUNNING_KERNELS);
+  while (count > 0) {
+    chunk = min(count, ROW_CHUNK);                                                                                  /* A multiple of 8 pixels */
+    if (out.end - out.cursor < 2 * chunk + 16) flush_output();                             /* Every pixel takes 2 bytes, so make room at once */
+    for (i = 0; i < chunk; i += 8) {
+      memcpy(out.cursor, bits_ascii[*bytes++], 16);                                                         /* All 8 pixels of a byte at once */
+      out.cursor += 2 * min(chunk - i, 8);                                         /* but only the pixels inside the line are kept at its end */
+    }
+    count -= chunk;
+  }
+  enter_phase(phase);
+}
+
+void put_packed(const unsigned char *samples, long count) {
+  long i;
+  int pixels, j, phase = enter_phase(RUNNING_KERNELS);
+  for (i = 0; i < count; i += 8) {
+    if (out.cursor == out.end) flush_output();
+    pixels = 0;
+    for (j = 0; j < 8; j++) pixels = pixels << 1 | ((i + j < count) ? samples[i + j] : 1);              /* Ace padding at the end of the line */
+    *out.cursor++ = pixels;
+  }
+  enter_phase(phase);
+}
+
+/* C has no templates, so the row kernels are instantiated by a macro, once for every output and class of max. Since "checked" is a constant,
+   the kernels for max 255 and 65535 compile without any range check, and the converters choose their kernel once, after the header. The pixels
+   of the line are counted for --histogram as "counted" (the magic number whose pixels they are), or by "put" itself if it makes new samples */
+#define ROW_KERNEL(name, samples, checked, put, counted)                                                                                       \
+int name(const unsigned char *row, long count, int y, int max) {                                                                               \
+  (void) y;                                                                                                                                    \
+  (void) max;                                                                                                                                  \
+  if ((checked) && valid_samples(row, (samples) * count, max) != OK) return ERROR;                                                             \
+  if ((counted) != 0 && histogram.active) count_pixels(row, counted, counted, count, max > 255);                                               \
+  put;                                                                                                                                         \
+  return OK;                                                                                                                                   \
+}
+
+ROW_KERNEL(threshold_row, 1, 0, put_threshold(row, count, (max + 1) / 2), GRAY_BINARY)
+ROW_KERNEL(threshold_wide_row, 1, 0, put_threshold_wide(row, count, (max + 1) / 2), GRAY_BINARY)
+ROW_KERNEL(dithered_row, 1, 0, put_dithered(row, count, y, max), GRAY_BINARY)
+ROW_KERNEL(luminosity_row, 3, 0, put_luminosity(row, count), 0)
+ROW_KERNEL(luminosity_checked_row, 3, 1, put_luminosity(row, count), 0)
+ROW_KERNEL(luminosity_wide_row, 3, 0, put_luminosity_wide(row, count), 0)
+ROW_KERNEL(luminosity_wide_checked_row, 3, 1, put_luminosity_wide(row, count), 0)
+ROW_KERNEL(gray_decimals_row, 1, 0, put_decimals(row, count), GRAY_BINARY)
+ROW_KERNEL(gray_decimals_checked_row, 1, 1, put_decimals(row, count), GRAY_BINARY)
+ROW_KERNEL(gray_decimals_wide_row, 1, 0, put_decimals_wide(row, count), GRAY_BINARY)
+ROW_KERNEL(gray_decimals_wide_checked_row, 1, 1, put_decimals_wide(row, count), GRAY_BINARY)
+ROW_KERNEL(color_decimals_row, 3, 0, put_decimals(row, 3 * count), COLOR_BINARY)
+ROW_KERNEL(color_decimals_checked_row, 3, 1, put_decimals(row, 3 * count), COLOR_BINARY)
+ROW_KERNEL(color_decimals_wide_row, 3, 0, put_decimals_wide(row, 3 * count), COLOR_BINARY)
+ROW_KERNEL(color_decimals_wide_checked_row, 3, 1, put_decimals_wide(row, 3 * count), COLOR_BINARY)
+ROW_KERNEL(bits_ascii_row, 1, 0, put_bits_ascii(row, count), BnW_BINARY)
+ROW_KERNEL(weighed_row, 3, 0, put_levels(row, count, GRAY_BINARY), 0)
+ROW_KERNEL(weighed_checked_row, 3, 1, put_levels(row, count, GRAY_BINARY), 0)
+ROW_KERNEL(rescaled_gray_row, 1, 0, put_levels(row, count, GRAY_ASCII), 0)
+ROW_KERNEL(rescaled_gray_checked_row, 1, 1, put_levels(row, count, GRAY_ASCII), 0)
+ROW_KERNEL(rescaled_color_row, 3, 0, put_levels(row, count, COLOR_ASCII), 0)
+ROW_KERNEL(rescaled_color_checked_row, 3, 1, put_levels(row, count, COLOR_ASCII), 0)
+
+ROW *row_kernel(int kind, int max) {
+  if (kind == BnW_BINARY && dither != NETPBM_THRESHOLD) return dithered_row;                              /* Dithering does not depend on max */
+  if (levels.weights != NULL || levels.rescale != NULL) return level_kernels[kind - '0'][max != 255 && max != MAX_VALUE];        /* -m and -l */
+  return row_kernels[kind - '0'][(max > 255) * 2 + (max != 255 && max != MAX_VALUE)];
+}
+
+int convert_bands(int kind, int *pch, int width, int height, int max) {
+  BANDS *bands;
+  pthread_t worker[MAX_THREADS];
+  int started = 0, band, i, first = 1, phase, last;                                              /* first: the first line left for the caller */
+  const unsigned char *raster = in.cursor - 1;                                            /* The current byte (ch) is the first of the raster */
+  long stride = (kind == BnW_ASCII) ? (width + 7) / 8 : (kind == GRAY_BINARY || kind == COLOR_ASCII) ? 3 * (long) width : width;
+  long line;                                                                                     /* Most bytes that a line may take in output */
+  int size = (max > 255) ? 2 : 1;
+  stride *= size;
+  if (threads < 2 || *pch == EOF || width <= 0 || height <= 0) return first;                          /* Convert on this thread, line by line */
+  if (kind == BnW_BINARY && dither == NETPBM_FLOYD_STEINBERG) return first;                       /* Each line carries errors to the next one */
+  if (in.end - raster < stride * height || stride * height < 2 * BAND_BYTES) return first;                    /* Only whole and large rasters */
+  bands = calloc(1, sizeof(BANDS));
+  if (bands == NULL) return first;
+  phase = enter_phase(RUNNING_KERNELS);                                                    /* The threads convert lines, while this one waits */
+  init_kernels();
+  bands->kind = kind;
+  bands->put_row = row_kernel(kind, max);
+  bands->width = width;
+  bands->height = height;
+  bands->max = max;
+  bands->stride = stride;
+  bands->size = size;
+  bands->levels = levels;
+  bands->histogram = &histogram;
+  bands->raster = raster;
+  bands->rows = (BAND_BYTES + stride - 1) / stride;                                               /* Every band has about BAND_BYTES of input */
+  bands->count = (height + bands->rows - 1) / bands->rows;
+  last = (levels.weights != NULL || levels.rescale != NULL) ? levels.last : max;                                 /* The max of output samples */
+  line = (kind == BnW_BINARY) ? (width + 7) / 8 : (kind == GRAY_BINARY) ? ((last > 255) ? 2 : 1) * (long) width
+       : (kind == BnW_ASCII) ? 2 * (long) width + 1 : (size == 1 && last > 255) ? 6 * stride + 1 : 4 * stride + 1;
+  for (i = 0; i < 2 * threads; i++) {
+    bands->slot[i].output.fd = -1;                                                                       /* Every band is converted in memory */
+    bands->slot[i].output.size = bands->rows * line + 64;                              /* Room for a whole band, so that it never has to grow */
+    bands->slot[i].output.data = malloc(bands->slot[i].output.size);
+    if (bands->slot[i].output.data == NULL) bands->count = 0;                                         /* Without memory, nothing is converted */
+  }
+  pthread_mutex_init(&bands->lock, NULL);
+  pthread_cond_init(&bands->changed, NULL);
+  while (started < threads && bands->count > 0 && pthread_create(&worker[started], NULL, band_worker, bands) == 0) started++;
+  if (started == 0) bands->count = 0;
+  for (band = 0; band < bands->count; band++) {                                                          /* Write the bands in order of lines */
+    BAND *slot = &bands->slot[band % (2 * threads)];
+    pthread_mutex_lock(&bands->lock);
+    while (slot->state == PENDING) pthread_cond_wait(&bands->changed, &bands->lock);
+    pthread_mutex_unlock(&bands->lock);
+    if (slot->state == FAILED) break;                                          /* The caller converts the rest, to find where the input fails */
+    put_bytes(slot->output.data, slot->output.cursor - slot->output.data);
+    pthread_mutex_lock(&bands->lock);
+    slot->state = PENDING;                                                                        /* The slot is free for a band further down */
+    bands->written++;
+    pthread_cond_broadcast(&bands->changed);
+    pthread_mutex_unlock(&bands->lock);
+  }
+  pthread_mutex_lock(&bands->lock);
+  bands->next = bands->count;                                                                        /* Threads stop after their current band */
+  pthread_cond_broadcast(&bands->changed);
+  pthread_mutex_unlock(&bands->lock);
+  for (i = 0; i < started; i++) pthread_join(worker[i], NULL);
+  if (band > 0) {                                                                   /* Continue from the first line that has not been written */
+    first = (band < bands->count) ? band * bands->rows + 1 : height + 1;
+    in.cursor = (unsigned char *) raster + (first - 1) * stride;
+    *pch = get_byte();
+  }
+  for (i = 0; i < 2 * threads; i++) free(bands->slot[i].output.data);
+  pthread_mutex_destroy(&bands->lock);
+  pthread_cond_destroy(&bands->changed);
+  free(bands);
+  enter_phase(phase);
+  return first;
+}
+
+void *band_worker(void *arg) {
+  BANDS *bands = arg;
+  BAND *slot;
+  int band, state;
+  start_histogram(bands->histogram->width, bands->histogram->height, bands->histogram->max, bands->histogram->active);   /* Counts of its own */
+  pthread_mutex_lock(&bands->lock);
+  while (bands->next < bands->count) {
+    if (bands->next >= bands->written + 2 * threads) {                                    /* Every slot is taken, so wait for output to go on */
+      pthread_cond_wait(&bands->changed, &bands->lock);
+      continue;
+    }
+    band = bands->next++;
+    slot = &bands->slot[band % (2 * threads)];
+    pthread_mutex_unlock(&bands->lock);
+    out = slot->output;                                                           /* The output of this thread goes to the memory of the slot */
+    levels = bands->levels;                                                            /* and the tables of the image are those of the caller */
+    state = convert_band(bands, band);
+    slot->output = out;
+    pthread_mutex_lock(&bands->lock);
+    if (histogram.active) gather_histogram(bands->histogram);                          /* A band that fails fails the image, which is not put */
+    slot->state = state;
+    pthread_cond_broadcast(&bands->changed);
+  }
+  pthread_mutex_unlock(&bands->lock);
+  return NULL;
+}
+
+int convert_band(const BANDS *bands, int band) {
+  const unsigned char *row = bands->raster + band * (long) bands->rows * bands->stride;
+  int h, last = min(bands->height, (band + 1) * bands->rows);
+  out.cursor = out.data;                                                                                   /* The slot may keep an older band */
+  out.end = out.data + out.size;
+  out.lost = 0;
+  for (h = band * bands->rows + 1; h <= last; h++) {
+    if (bands->put_row(row, bands->width, h - 1, bands->max) != OK) return FAILED;              /* The kernel of the fast paths of converters */
+    if (bands->kind <= COLOR_ASCII) put_byte('\n');                                           /* Lines of images in ASCII end with a new line */
+    row += bands->stride;
+  }
+  return out.lost ? FAILED : DONE;
+}
+
+void init_kernels(void) {
+  unsigned char byte = 0;
+  if (!tables_ready) init_tables();
+  luminosity(&byte, &byte, 0);                                                                    /* Converting no pixels chooses the kernels */
+  luminosity_wide(&byte, &byte, 0);
+  weigh_luma(&byte, &byte, 0);
+  threshold_pack(&byte, &byte, 0, 0);
+  ordered_pack(&byte, &byte, 0, bayer[0]);
+  drop_samples(&byte, &byte, 0, 1, 1);
+  float_samples(&byte, &byte, 0, 255, 1);
+  sample_floats(&byte, &byte, 0, 255);
+}
+
+int convert_batch(int bonus, const char *list, const char *directory) {
+  BATCH *batch;
+  WORKER worker[MAX_THREADS];
+  DIR *dir;
+  struct dirent *entry;
+  struct stat info;
+  char *path, *text, *input, *output;
+  long length, done;
+  int fd, i, converted = 0, status = OK;
+  batch = calloc(1, sizeof(BATCH));
+  if (batch == NULL) return ERROR;
+  batch->bonus = bonus;
+  if (directory != NULL) {                                             /* Every file of a directory is converted into a file of the same name */
+    dir = opendir(list);
+    if (dir == NULL) {
+      printf("Cannot open input directory \"%s\".\n", list);
+      end_batch(batch);
+      return ERROR;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+      length = strlen(list) + strlen(directory) + 2 * strlen(entry->d_name) + 4;
+      path = malloc(length);
+      if (path == NULL) break;
+      sprintf(path, "%s/%s", list, entry->d_name);
+      if (stat(path, &info) == 0 && S_ISREG(info.st_mode)) {                                             /* Skip ".", ".." and subdirectories */
+        output = path + strlen(path) + 1;                                                                         /* Both paths share a block */
+        sprintf(output, "%s/%s", directory, entry->d_name);
+        if (add_job(batch, path, output) != OK) {
+          free(path);
+          break;
+        }
+      }
+      else free(path);
+    }
+    closedir(dir);
+    if (batch->count > 0) qsort(batch->job, batch->count, sizeof(JOB), compare_jobs);                        /* The summary follows the names */
+  }
+  else {                                                                                 /* A list file holds pairs of input and output paths */
+    fd = open(list, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0 || (text = malloc(info.st_size + 1)) == NULL) {
+      printf("Cannot open list file \"%s\".\n", list);
+      if (fd >= 0) close(fd);
+      end_batch(batch);
+      return ERROR;
+    }
+    batch->text = text;                                                                                /* The paths of the jobs point into it */
+    for (done = 0; done < info.st_size && (length = read(fd, text + done, info.st_size - done)) > 0; done += length);
+    text[done] = '\0';
+    close(fd);
+    input = strtok(text, " \t\r\n");                                                                    /* Paths are separated by white space */
+    while (input != NULL) {
+      output = strtok(NULL, " \t\r\n");
+      if (output == NULL) {
+        printf("Input file \"%s\" of list file \"%s\" has no output file.\n", input, list);
+        end_batch(batch);
+        return ERROR;
+      }
+      if (add_job(batch, input, output) != OK) break;
+      input = strtok(NULL, " \t\r\n");
+    }
+  }
+  batch->workers = min(threads, batch->count > 0 ? batch->count : 1);                                       /* -j gives the number of workers */
+  threads = 1;                                                                                    /* and then every image is converted on one */
+  init_kernels();
+  for (i = 0; i < batch->workers; i++) {                                    /* Every worker starts with an equal share of the images in order */
+    batch->queue[i].head = (long) batch->count * i / batch->workers;
+    batch->queue[i].tail = (long) batch->count * (i + 1) / batch->workers;
+    pthread_mutex_init(&batch->queue[i].lock, NULL);
+    worker[i].batch = batch;
+    worker[i].id = i;
+  }
+  for (i = 1; i < batch->workers; i++) {
+    if (pthread_create(&worker[i].thread, NULL, batch_worker, &worker[i]) != 0) break;              /* The jobs of missing workers get stolen */
+  }
+  batch_worker(&worker[0]);                                                               /* This thread is a worker too, with its own blocks */
+  while (--i > 0) pthread_join(worker[i].thread, NULL);
+  out.fd = STDOUT_FILENO;                                                                                   /* The summary goes to the output */
+  for (i = 0; i < batch->count; i++) {
+    printf("%s -> %s: ", batch->job[i].input, batch->job[i].output);
+    switch (batch->job[i].status) {
+      case OK:
+        printf("OK\n");
+        converted++;
+        break;
+      case NO_INPUT:
+        printf("Cannot open input file\n");
+        break;
+      case NO_OUTPUT:
+        printf("Cannot create output file\n");
+        break;
+      default:
+        printf("Input error\n");
+    }
+  }
+  printf("Converted %d of %d images.\n", converted, batch->count);
+  if (converted != batch->count) status = ERROR;
+  end_batch(batch);
+  return status;
+}
+
+void end_batch(BATCH *batch) {
+  int i;
+  if (batch->text == NULL) {
+    for (i = 0; i < batch->count; i++) free(batch->job[i].input);                                     /* The output path is in the same block */
+  }
+  free(batch->text);
+  for (i = 0; i < batch->workers; i++) pthread_mutex_destroy(&batch->queue[i].lock);
+  free(batch->job);
+  free(batch);
+}
+
+int add_job(BATCH *batch, const char *input, const char *output) {
+  JOB *job;
+  if ((batch->count & (batch->count - 1)) == 0) {                                                  /* The jobs grow in powers of 2, when full */
+    job = realloc(batch->job, 2 * (batch->count + 1) * sizeof(JOB));
+    if (job == NULL) return ERROR;
+    batch->job = job;
+  }
+  batch->job[batch->count].input = (char *) input;
+  batch->job[batch->count].output = (char *) output;
+  batch->job[batch->count].status = ERROR;                                                           /* until the image is actually converted */
+  batch->count++;
+  return OK;
+}
+
+int compare_jobs(const void *a, const void *b) {
+  return strcmp(((const JOB *) a)->input, ((const JOB *) b)->input);
+}
+
+void *batch_worker(void *arg) {
+  WORKER *worker = arg;
+  unsigned char *block = input_data;                                                                       /* The first worker has the blocks */
+  int job;
+  if (worker->id > 0) {                                                                  /* of this thread, every other one allocates its own */
+    block = malloc(2 * BUFFER_SIZE);
+    if (block == NULL) return NULL;                                                                          /* The others steal all its jobs */
+    out.data = block + BUFFER_SIZE;
+    out.size = BUFFER_SIZE;
+  }
+  while ((job = next_job(worker->batch, worker->id)) >= 0) {
+    convert_file(worker->batch, &worker->batch->job[job], block);                     /* Both blocks are reused for every image of the worker */
+  }
+  if (worker->id > 0) free(block);
+  if (stats_enabled) merge_stats();
+  return NULL;
+}
+
+int next_job(BATCH *batch, int id) {
+  QUEUE *queue;
+  int job = -1, i;
+  for (i = 0; i < batch->workers && job < 0; i++) {                                        /* First the own queue, then the next ones in turn */
+    queue = &batch->queue[(id + i) % batch->workers];
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) job = (i == 0) ? queue->head++ : --queue->tail;
+    pthread_mutex_unlock(&queue->lock);
+  }
+  return job;                                                                              /* Jobs are never added, so -1 means all are taken */
+}
+
+void convert_file(BATCH *batch, JOB *job, unsigned char *block) {
+  char *path;
+  int fd = open(job->input, O_RDONLY);
+  if (fd < 0) {
+    job->status = NO_INPUT;
+    return;
+  }
+  out.fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (out.fd < 0) {
+    close(fd);
+    job->status = NO_OUTPUT;
+    return;
+  }
+  in.data = block;                                                                           /* Start over with empty buffers for every image */
+  in.size = BUFFER_SIZE;
+  in.cursor = in.end = block;
+  out.cursor = out.data;
+  out.end = out.data + out.size;
+  map_input(fd);
+  if (histogram_enabled && (path = malloc(strlen(job->output) + 6)) != NULL) {                        /* The statistics go next to the output */
+    sprintf(path, "%s.json", job->output);
+    histogram_file = fopen(path, "w");
+    free(path);
+  }
+  job->status = convert(batch->bonus);                                            /* An input error ends this image only, not the whole batch */
+  if (histogram_file != NULL) fclose(histogram_file);
+  histogram_file = NULL;
+  flush_output();
+  close(out.fd);
+  if (in.fd >= 0) close(in.fd);
+  if (in.data != block) munmap(in.data, in.size);                                                           /* The image was mapped to memory */
+}
+
+int serve(const char *path) {
+  struct sockaddr_un address;
+  struct stat info;
+  pthread_t thread[MAX_THREADS], stopper;
+  static sigset_t stop;                                                                           /* The signals that stop_server() waits for */
+  int listener, workers = threads, i;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) < sizeof(address.sun_path)) strcpy(address.sun_path, path);
+  if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path);                          /* The socket of a previous server is replaced */
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || address.sun_path[0] == '\0' || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0
+      || listen(listener, SOMAXCONN) != 0) {
+    printf("Cannot listen on socket \"%s\".\n", path);
+    return ERROR;
+  }
+  signal(SIGPIPE, SIG_IGN);                                                            /* A client that leaves early ends its connection only */
+  if (stats_enabled) {                                                    /* The server runs until it is stopped, so --stats is reported then */
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);                                          /* The workers inherit the mask, and only stop_server() */
+    if (pthread_create(&stopper, NULL, stop_server, &stop) != 0) pthread_sigmask(SIG_UNBLOCK, &stop, NULL);              /* takes the signals */
+  }
+  threads = 1;                                                                          /* -j gives the number of workers, like in batch mode */
+  printf("Serving on \"%s\" with %d workers.\n", path, workers);
+  fflush(stdout);
+  for (i = 1; i < workers; i++) {
+    if (pthread_create(&thread[i], NULL, server_worker, &listener) != 0) break;                        /* The workers that started are enough */
+  }
+  server_worker(&listener);                                                                                    /* This thread is a worker too */
+  return ERROR;                                                                                            /* Only if accepting clients fails */
+}
+
+void *server_worker(void *arg) {
+  CONNECTION *connection = malloc(sizeof(CONNECTION));
+  int listener = *(int *) arg;
+  if (connection == NULL) return NULL;
+  while ((connection->fd = accept(listener, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED) {
+    if (connection->fd < 0) continue;                                                          /* The kernel gives every client to one worker */
+    connection->cursor = connection->end = connection->data;
+    serve_connection(connection);
+    close(connection->fd);
+  }
+  free(connection);
+  if (stats_enabled) merge_stats();
+  return NULL;
+}
+
+void *stop_server(void *arg) {
+  int number;
+  sigwait(arg, &number);
+  report_stats();                                                                             /* with the profiles of every request converted */
+  _exit(OK);
+}
+
+void serve_connection(CONNECTION *connection) {
+  NETPBM_STREAM *stream;
+  char line[64], word[16], trailer[96], extra;
+  int mode, status;
+  long length, left, count;
+  double start;
+  while (receive_line(connection, line, sizeof(line)) == OK) {                               /* A request is "mode length\n" and length bytes */
+    start = clock_seconds();
+    if (sscanf(line, "%15s %ld %c", word, &length, &extra) != 2 || length < 0) mode = ERROR;
+    else if (!strcmp(word, "standard") || !strcmp(word, "bonus")) mode = (word[0] == 'b');                            /* The modes of the CLI */
+    else if (word[0] == 'P' && ((word[1] >= BnW_ASCII && word[1] <= COLOR_BINARY) || tupled(word[1])) && word[2] == '\0') {
+      mode = word[1];                                                                                                                /* or -t */
+    }
+    else mode = ERROR;
+    if (mode == ERROR) {                                                                /* The rest of the connection cannot be made sense of */
+      write_block(connection->fd, (const unsigned char *) "0 -2 0 0 0\n", 11);
+      return;
+    }
+    connection->output = 0;
+    stream = netpbm_stream_open(mode, send_chunk, connection);                         /* The image is converted as it arrives, and sent back */
+    for (left = length; left > 0; left -= count) {
+      count = min(receive(connection), left);
+      if (count == 0) break;                                                                                               /* The client left */
+      if (stream != NULL) netpbm_stream_feed(stream, connection->cursor, count);
+      connection->cursor += count;
+    }
+    status = (stream != NULL) ? netpbm_stream_close(stream) : NETPBM_NO_MEMORY;
+    if (left > 0) return;
+    count = sprintf(trailer, "0 %d %ld %ld %ld\n", status, length, connection->output,                         /* and "0 status input output" */
+                    (long) ((clock_seconds() - start) * 1e6));                                                 /* "microseconds\n" at the end */
+    write_block(connection->fd, (unsigned char *) trailer, count);
+  }
+}
+
+long receive(CONNECTION *connection) {
+  ssize_t count;
+  if (connection->cursor < connection->end) return connection->end - connection->cursor;
+  do {
+    count = read(connection->fd, connection->data, BUFFER_SIZE);
+  } while (count < 0 && errno == EINTR);
+  if (count <= 0) return 0;                                                                    /* The client closed the connection, or failed */
+  connection->cursor = connection->data;
+  connection->end = connection->data + count;
+  return count;
+}
+
+int receive_line(CONNECTION *connection, char *line, int size) {
+  int length = 0;
+  while (receive(connection) > 0) {
+    if (*connection->cursor == '\n') {
+      connection->cursor++;
+      line[length] = '\0';
+      return OK;
+    }
+    if (length == size - 1) return ERROR;                                                                         /* Requests are short lines */
+    line[length++] = *connection->cursor++;
+  }
+  return ERROR;
+}
+
+void send_chunk(void *context, const unsigned char *bytes, long count) {
+  CONNECTION *connection = context;
+  char header[24];
+  write_block(connection->fd, (unsigned char *) header, sprintf(header, "%ld\n", count));            /* Output is sent as "count\n" and bytes */
+  write_block(connection->fd, bytes, count);
+  connection->output += count;
+}
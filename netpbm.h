@@ -0,0 +1,57 @@
+/* File: netpbm.h */
+/* The converters of netpbm.c as a library. Compiled with -DNETPBM_LIBRARY, netpbm.c leaves out main(): "make libnetpbm.a" builds the
+   static library, and "make libnetpbm.so" the shared one */
+#ifndef NETPBM_H
+#define NETPBM_H
+
+#define NETPBM_OK          0                                                                                  /* The image has been converted */
+#define NETPBM_ERROR      -2                                            /* Unexpected input: the output ends with "Input error!" like the CLI */
+#define NETPBM_NO_SPACE   -5                                                                /* The output does not fit in the caller's buffer */
+#define NETPBM_NO_MEMORY  -6                                                                                /* The library could not allocate */
+
+/* With bonus 0 an image in P3 becomes P2, P2 becomes P1, P6 becomes P5 and P5 becomes P4, and with bonus 1 an image in ASCII becomes binary and
+   vice versa, exactly like the CLI. Only the image at the start of the input is converted. netpbm_convert() fills at most *output_length bytes
+   and then sets it to the length of the whole output, so that it is larger than the buffer only with NETPBM_NO_SPACE. A buffer of
+   netpbm_output_size() bytes is always enough, and netpbm_convert_alloc() allocates one with malloc(), which the caller frees. With bonus
+   NETPBM_TO(n) any image becomes Pn in one pass, exactly like the chain of CLI runs that leads there, if Pn has no more colors than it. PAM
+   (P7) of any depth and PFM (PF and Pf) are read too. Their standard case drops a level of colors in the same format: P7 of RGB becomes P7 of
+   gray, which becomes P7 of BnW, PF becomes Pf, and Pf becomes P4, as PFM has no BnW. Their bonus case gives the P4, P5 or P6 of their pixels.
+   Alpha, and any sample after the gray or RGB ones, is dropped, and floats from 0 to 1 become samples of max 255, or of netpbm_set_maxval().
+   PFM is stored from the bottom line up, so its lines are read a block at a time from the end of the raster when it is all in memory, as an
+   image of netpbm_convert() or a mapped file, and else the raster is kept whole, as samples. PAM is written with the depth of the pixels, and
+   PFM with little endian floats, which take 2 bytes of precision from PFM input. Samples of 2 bytes, with a max above 255, stay so in every
+   case, unless netpbm_set_maxval(255) reduces them to 1 byte, in the same pass */
+#define NETPBM_TO(n)       ('0' + (n))                                                          /* Mode of a direct conversion to P1, ..., P7 */
+#define NETPBM_TO_PFM      'F'                                                            /* Mode of a direct conversion to PF, of RGB floats */
+#define NETPBM_TO_PFM_GRAY 'f'                                                                                    /* or to Pf, of gray floats */
+
+long netpbm_output_size(const unsigned char *image, long length, int bonus);                     /* Room that the output of an image may need */
+int netpbm_convert(const unsigned char *image, long length, unsigned char *output, long *output_length, int bonus);      /* Convert in memory */
+int netpbm_convert_alloc(const unsigned char *image, long length, unsigned char **output, long *output_length, int bonus);    /* and allocate */
+int netpbm_check(const unsigned char *image, long length, long *error_offset);      /* NETPBM_OK if valid, else the offset of the first error */
+int netpbm_set_threads(int count);                                                  /* Number of threads that convert each large binary image */
+int netpbm_set_dither(int method);                                                    /* How gray becomes BnW, one of the three methods below */
+#define NETPBM_THRESHOLD         0                                                  /* Black below (max + 1) / 2 and white above, the default */
+#define NETPBM_FLOYD_STEINBERG   1                   /* Error diffusion over two lines, pixel by pixel on one thread, so tens of times slower */
+#define NETPBM_BAYER             2                                            /* Ordered dithering with an 8x8 matrix, as fast as the default */
+#define NETPBM_OTSU              3          /* The threshold of Otsu's method, from the histogram of the whole image, which is kept in memory */
+int netpbm_set_crop(int x, int y, int width, int height);                           /* Keep only a rectangle of every image, cut at its sides */
+int netpbm_set_scale(int factor);                 /* Shrink every image by a factor of 1 to 256 in both directions, averaging boxes of pixels */
+int netpbm_set_maxval(int max);                                             /* The max of every output image with gray or color, or 0 to keep */
+int netpbm_set_luminosity(int method);                                                /* How color becomes gray, one of the two methods below */
+#define NETPBM_LUMA              0                                                    /* 0.299R + 0.587G + 0.114B of the samples, the default */
+#define NETPBM_LINEAR            1      /* 0.2126R + 0.7152G + 0.0722B of the light of sRGB samples, encoded back: by lookups, 3 times slower */
+
+/* A stream converts every image of an input that arrives in chunks, such as an upload, without buffering it whole. It is not a state
+   machine: the converters of the CLI run on a thread of the stream, which blocks wherever a chunk ends, even in the middle of a header, a
+   comment or a number, until the next chunk is fed. Output is handed to the sink in blocks, on the thread of the caller and only inside
+   netpbm_stream_feed() and netpbm_stream_close(). Feeding returns NETPBM_OK as long as the conversion goes on, and its final status once
+   it has ended. Closing ends the input, so the last image is completed. While it is open, each stream holds its thread, with 512 KiB of
+   stack and thread-local buffers, and 128 KiB for its output, so at most NETPBM_MAX_STREAMS are open at once; beyond, opening gives NULL */
+#define NETPBM_MAX_STREAMS       256                                                                      /* Streams that may be open at once */
+typedef struct NETPBM_STREAM NETPBM_STREAM;
+NETPBM_STREAM *netpbm_stream_open(int bonus, void (*sink)(void *context, const unsigned char *bytes, long count), void *context);  /* or NULL */
+int netpbm_stream_feed(NETPBM_STREAM *stream, const unsigned char *bytes, long count);                              /* Convert the next chunk */
+int netpbm_stream_close(NETPBM_STREAM *stream);                                                           /* Finish and free, with the status */
+
+#endif
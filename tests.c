@@ -0,0 +1,590 @@
+/* File: tests.c */
+/* Checks of the library. Every vectorized kernel is called directly, at each level of the dispatch that the CPU supports, and its output
+   is compared byte by byte with the scalar kernel, on odd widths and tails, unaligned buffers and samples of 1 and 2 bytes. Then every
+   direct conversion is compared with the chain of standard and bonus cases that leads to its format, as the CLI would run them, and streams
+   of many images, each starting right after the last sample of the one before, with the images converted one by one. Build and run it with
+   "make check": it prints every failure, and exits with 1 if there is any */
+#include <stdio.h>                                                                                    /* Header file for standard I/O library */
+#include <string.h>                                           /* Header file which contains declarations of functions that operate on strings */
+#include <stdlib.h>                                                                                               /* Header file for malloc() */
+#include "netpbm.h"                                                                                   /* Header file of the library interface */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_KERNELS                                                                        /* The same condition as netpbm.c, for its kernels */
+#endif
+#define ROOM               4200                                       /* Bytes of each buffer: the longest count of pixels, with 6 bytes each */
+#define depth(magic)       (((magic) - '1') % 3 + 1)                                 /* 1 for BnW, 2 for gray and 3 for color, as in netpbm.c */
+#define GUARD              32                                                 /* Bytes after the output, which kernels must leave as they are */
+
+/* The kernels are not part of the interface of netpbm.h, so they are declared here as netpbm.c defines them */
+typedef void LUMINOSITY(const unsigned char *rgb, unsigned char *gray, int count);
+typedef void THRESHOLD(const unsigned char *gray, unsigned char *bits, int count, int threshold);
+typedef void ORDERED(const unsigned char *gray, unsigned char *bits, int count, const unsigned char *limits);
+typedef void DROP(const unsigned char *samples, unsigned char *pixels, int count, int stride, int kept);
+typedef void FLOATS(const unsigned char *floats, unsigned char *samples, long count, int max, int little);
+typedef void SAMPLES(const unsigned char *samples, unsigned char *floats, long count, int max);
+LUMINOSITY luminosity_scalar, luminosity_dispatch, luminosity_wide_scalar, luminosity_wide_dispatch, weigh_scalar;
+THRESHOLD threshold_scalar, threshold_dispatch;
+ORDERED ordered_scalar;
+DROP drop_samples_scalar;
+FLOATS float_samples_scalar;
+SAMPLES sample_floats_scalar;
+int start_levels(int magic, int target, int max);
+void end_levels(void);
+#ifdef X86_KERNELS
+LUMINOSITY luminosity_ssse3, luminosity_avx2, luminosity_wide_sse41, luminosity_wide_avx2, weigh_luma_avx2;
+THRESHOLD threshold_sse2, threshold_avx2;
+ORDERED ordered_sse2, ordered_avx2;
+DROP drop_samples_ssse3;
+FLOATS float_samples_sse2;
+SAMPLES sample_floats_sse2;
+#endif
+
+typedef struct {                                                                                                 /* Bytes collected in memory */
+  unsigned char *bytes;
+  long length, room;
+} BLOCK;
+
+typedef struct {                                                                                         /* A vectorized kernel and its level */
+  const char *name, *feature;                                                               /* feature: the CPU feature that the kernel needs */
+  void *kernel;
+} LEVEL;
+
+static const int counts[] = {0, 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 23, 31, 32, 33, 47, 63, 64, 65, 95, 127, 128, 129, 255, 257, 333, 700};
+static unsigned int seed = 2463534242u;                                                /* State of the generator, so that runs are repeatable */
+static unsigned char input[ROOM + 1], expected[ROOM + GUARD], actual[ROOM + GUARD];                        /* input + 1 is an unaligned start */
+static int checks = 0, failures = 0;
+
+unsigned int next_random(void);                                                                                         /* Xorshift generator */
+int supported(const LEVEL *level);                                                                      /* Check that the CPU can run a level */
+void fill(unsigned char *bytes, long count, int max, int wide);                                     /* Random samples from 0 to max, or bytes */
+void compare(const char *name, long count, long length, int parameter);              /* Compare the outputs of a kernel, with the guard after */
+void clear(void);                                                                                        /* Set both outputs and guards alike */
+void check_luminosity(void);                                                                             /* Luminosity of bytes, for P6 -> P5 */
+void check_luminosity_wide(void);                                                                 /* and of samples of 2 bytes, for 16-bit P6 */
+void check_weigh_luma(void);                                                                                           /* Luma of -m, rounded */
+void check_rounding(void);                                                                /* Gray of -m against its rule, in binary and ASCII */
+void check_threshold(void);                                                                               /* Threshold and pack, for P5 -> P4 */
+void check_ordered(void);                                                                                      /* Bayer dithering and packing */
+void check_drop_samples(void);                                                                               /* Alpha dropped from PAM tuples */
+void check_float_samples(void);                                                                                   /* Floats of PFM as samples */
+void check_sample_floats(void);                                                                                      /* and samples as floats */
+unsigned char *generate(char magic, int width, int height, int max, int over, long *length);     /* A random image, samples above max if over */
+int convert_steps(const unsigned char *image, long length, char magic, char target, unsigned char **output, long *output_length);
+void check_chains(void);                                                                     /* Direct conversions against the chains of runs */
+void collect(void *context, const unsigned char *bytes, long count);                                        /* Sink of a stream, into a BLOCK */
+void check_frames(void);                                                     /* Streams of images without white space between them, in chunks */
+void check_floats(void);                                                  /* PFM in memory, read a block of lines at a time, against a stream */
+void check_stream_limit(void);                                                                      /* Streams are refused beyond their limit */
+
+
+int main(void) {
+  check_luminosity();
+  check_luminosity_wide();
+  check_weigh_luma();
+  check_rounding();
+  check_threshold();
+  check_ordered();
+  check_drop_samples();
+  check_float_samples();
+  check_sample_floats();
+  check_chains();
+  check_frames();
+  check_floats();
+  check_stream_limit();
+  printf("%d checks, %d failures\n", checks, failures);
+  return failures > 0;
+}
+
+unsigned int next_random(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+int supported(const LEVEL *level) {
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && !strcmp(level->feature, "avx2")) return 1;             /* The argument of the builtin must be literal */
+  if (__builtin_cpu_supports("sse4.1") && !strcmp(level->feature, "sse4.1")) return 1;
+  if (__builtin_cpu_supports("ssse3") && !strcmp(level->feature, "ssse3")) return 1;
+  if (__builtin_cpu_supports("sse2") && !strcmp(level->feature, "sse2")) return 1;
+#endif
+  printf("skipped %s: the CPU has no %s\n", level->name, level->feature);
+  return 0;
+}
+
+void fill(unsigned char *bytes, long count, int max, int wide) {
+  long i;
+  int sample;
+  for (i = 0; i < count; i++) {
+    sample = (i % 17 == 0) ? max : (i % 13 == 0) ? 0 : (int) (next_random() % (max + 1));                 /* The extremes appear in every run */
+    if (wide) {
+      bytes[2 * i] = sample >> 8;                                                                          /* The most significant byte first */
+      bytes[2 * i + 1] = sample & 0xFF;
+    }
+    else bytes[i] = sample;
+  }
+}
+
+void clear(void) {
+  memset(expected, 0xA5, sizeof(expected));
+  memset(actual, 0xA5, sizeof(actual));
+}
+
+void compare(const char *name, long count, long length, int parameter) {
+  long i;
+  checks++;
+  for (i = 0; i < length + GUARD && expected[i] == actual[i]; i++);
+  if (i < length + GUARD) {
+    failures++;
+    printf("%s: %ld pixels with %d differ at byte %ld%s\n", name, count, parameter, i, (i >= length) ? ", after the output" : "");
+  }
+}
+
+void check_luminosity(void) {
+#ifdef X86_KERNELS
+  static const LEVEL levels[] = {{"luminosity_ssse3", "ssse3", luminosity_ssse3}, {"luminosity_avx2", "avx2", luminosity_avx2}};
+  int i, j, offset;
+  luminosity_dispatch(input, actual, 0);                                                           /* Any table of the kernels is built first */
+  for (i = 0; i < (int) (sizeof(levels) / sizeof(levels[0])); i++) {
+    if (!supported(&levels[i])) continue;
+    for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+      for (offset = 0; offset <= 1; offset++) {
+        fill(input + offset, 3 * counts[j], 255, 0);
+        clear();
+        luminosity_scalar(input + offset, expected, counts[j]);
+        ((LUMINOSITY *) levels[i].kernel)(input + offset, actual, counts[j]);
+        compare(levels[i].name, counts[j], counts[j], offset);
+      }
+    }
+  }
+#endif
+}
+
+void check_luminosity_wide(void) {
+#ifdef X86_KERNELS
+  static const LEVEL levels[] = {{"luminosity_wide_sse41", "sse4.1", luminosity_wide_sse41},
+                                 {"luminosity_wide_avx2", "avx2", luminosity_wide_avx2}};
+  static const int maxes[] = {256, 1023, 4095, 65535};
+  int i, j, k;
+  luminosity_wide_dispatch(input, actual, 0);
+  for (i = 0; i < (int) (sizeof(levels) / sizeof(levels[0])); i++) {
+    if (!supported(&levels[i])) continue;
+    for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+      for (k = 0; k < (int) (sizeof(maxes) / sizeof(maxes[0])); k++) {
+        fill(input + 1, 3 * counts[j], maxes[k], 1);
+        clear();
+        luminosity_wide_scalar(input + 1, expected, counts[j]);
+        ((LUMINOSITY *) levels[i].kernel)(input + 1, actual, counts[j]);
+        compare(levels[i].name, counts[j], 2 * counts[j], maxes[k]);
+      }
+    }
+  }
+#endif
+}
+
+void check_weigh_luma(void) {
+#ifdef X86_KERNELS
+  static const LEVEL level = {"weigh_luma_avx2", "avx2", weigh_luma_avx2};
+  static const int maxes[][2] = {{255, 1}, {255, 15}, {255, 100}, {255, 254}, {100, 255}, {3, 7}, {1, 255}, {254, 255}, {200, 200}, {255, 255}};
+  int j, k;
+  if (!supported(&level)) return;
+  for (k = 0; k < (int) (sizeof(maxes) / sizeof(maxes[0])); k++) {                                    /* The max of input, then the max of -m */
+    netpbm_set_maxval(maxes[k][1]);
+    if (start_levels('6', '5', maxes[k][0]) != 0) {
+      printf("weigh_luma_avx2: no memory for the tables\n");
+      failures++;
+      break;
+    }
+    for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+      fill(input + 1, 3 * counts[j], maxes[k][0], 0);
+      clear();
+      weigh_scalar(input + 1, expected, counts[j]);
+      weigh_luma_avx2(input + 1, actual, counts[j]);
+      compare(level.name, counts[j], counts[j], maxes[k][1]);
+    }
+    end_levels();
+  }
+  netpbm_set_maxval(0);
+#endif
+}
+
+void check_rounding(void) {
+  static const int maxes[][2] = {{255, 255}, {200, 200}, {255, 100}, {3, 7}, {1000, 1000}, {65535, 65535}, {65535, 255}, {300, 40000}};
+  unsigned char *image, *ascii, *output;
+  const unsigned char *rgb, *gray;
+  long length, ascii_length, output_length;
+  int k, pass, width, height, max, start, i, size, wide, value, sample[3];
+  for (k = 0; k < (int) (sizeof(maxes) / sizeof(maxes[0])); k++) {                                    /* The max of input, then the max of -m */
+    image = generate('6', 1 + next_random() % 67, 1 + next_random() % 5, maxes[k][0], 0, &length);
+    if (image == NULL || netpbm_convert_alloc(image, length, &ascii, &ascii_length, 1) != NETPBM_OK) {                  /* and the same in P3 */
+      printf("check_rounding: no memory for the images\n");
+      failures++;
+      free(image);
+      return;
+    }
+    sscanf((char *) image, "P6 %d %d %d%n", &width, &height, &max, &start);
+    rgb = image + start + 1;
+    size = (max > 255) ? 2 : 1;
+    wide = maxes[k][1] > 255;
+    netpbm_set_maxval(maxes[k][1]);
+    for (pass = 0; pass < 2; pass++) {                                                                   /* Samples are weighed alike in both */
+      checks++;
+      start = 0;
+      if (netpbm_convert_alloc(pass ? ascii : image, pass ? ascii_length : length, &output, &output_length, NETPBM_TO(5)) != NETPBM_OK
+          || (sscanf((char *) output, "P5 %*d %*d %*d%n", &start), start == 0)) {
+        printf("check_rounding: P%c of max %d cannot be converted with -m %d\n", pass ? '3' : '6', maxes[k][0], maxes[k][1]);
+        failures++;
+        free(output);
+        continue;
+      }
+      gray = output + start + 1;
+      for (i = 0; i < width * height; i++) {
+        for (value = 0; value < 3; value++) {
+          sample[value] = (size == 2) ? rgb[6 * i + 2 * value] << 8 | rgb[6 * i + 2 * value + 1] : rgb[3 * i + value];
+        }
+        value = 299 * sample[0] + 587 * sample[1] + 114 * sample[2];                                                        /* In thousandths */
+        value = (2LL * value * maxes[k][1] + 1000LL * max) / (2000LL * max);                                                /* To the nearest */
+        if (value != (wide ? gray[2 * i] << 8 | gray[2 * i + 1] : gray[i])) {
+          printf("check_rounding: P%c of max %d with -m %d gives %d instead of %d at pixel %d\n", pass ? '3' : '6', max, maxes[k][1],
+                 wide ? gray[2 * i] << 8 | gray[2 * i + 1] : gray[i], value, i);
+          failures++;
+          break;
+        }
+      }
+      free(output);
+    }
+    netpbm_set_maxval(0);
+    free(image);
+    free(ascii);
+  }
+}
+
+void check_threshold(void) {
+#ifdef X86_KERNELS
+  static const LEVEL levels[] = {{"threshold_sse2", "sse2", threshold_sse2}, {"threshold_avx2", "avx2", threshold_avx2}};
+  static const int thresholds[] = {0, 1, 7, 127, 128, 200, 254, 255};
+  int i, j, k;
+  threshold_dispatch(input, actual, 0, 0);                                                                /* The dispatch builds black_bits[] */
+  for (i = 0; i < (int) (sizeof(levels) / sizeof(levels[0])); i++) {
+    if (!supported(&levels[i])) continue;
+    for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+      for (k = 0; k < (int) (sizeof(thresholds) / sizeof(thresholds[0])); k++) {
+        fill(input + 1, counts[j], 255, 0);
+        clear();
+        threshold_scalar(input + 1, expected, counts[j], thresholds[k]);
+        ((THRESHOLD *) levels[i].kernel)(input + 1, actual, counts[j], thresholds[k]);
+        compare(levels[i].name, counts[j], (counts[j] + 7) / 8, thresholds[k]);
+      }
+    }
+  }
+#endif
+}
+
+void check_ordered(void) {
+#ifdef X86_KERNELS
+  static const LEVEL levels[] = {{"ordered_sse2", "sse2", ordered_sse2}, {"ordered_avx2", "avx2", ordered_avx2}};
+  unsigned char limits[8];
+  int i, j, k;
+  threshold_dispatch(input, actual, 0, 0);
+  for (i = 0; i < (int) (sizeof(levels) / sizeof(levels[0])); i++) {
+    if (!supported(&levels[i])) continue;
+    for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+      for (k = 0; k < 4; k++) {                                                                        /* Random thresholds for the 8 columns */
+        fill(limits, 8, 255, 0);
+        fill(input + 1, counts[j], 255, 0);
+        clear();
+        ordered_scalar(input + 1, expected, counts[j], limits);
+        ((ORDERED *) levels[i].kernel)(input + 1, actual, counts[j], limits);
+        compare(levels[i].name, counts[j], (counts[j] + 7) / 8, k);
+      }
+    }
+  }
+#endif
+}
+
+void check_drop_samples(void) {
+#ifdef X86_KERNELS
+  static const LEVEL level = {"drop_samples_ssse3", "ssse3", drop_samples_ssse3};
+  static const int tuples[][2] = {{4, 3}, {2, 1}, {3, 3}, {4, 1}};                                    /* Bytes of each tuple, then bytes kept */
+  int j, k;
+  if (!supported(&level)) return;
+  for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+    for (k = 0; k < (int) (sizeof(tuples) / sizeof(tuples[0])); k++) {
+      fill(input + 1, tuples[k][0] * counts[j], 255, 0);
+      clear();
+      drop_samples_scalar(input + 1, expected, counts[j], tuples[k][0], tuples[k][1]);
+      drop_samples_ssse3(input + 1, actual, counts[j], tuples[k][0], tuples[k][1]);
+      memset(actual + tuples[k][1] * counts[j], 0xA5, GUARD);                              /* It may store 4 bytes past the pixels, by design */
+      compare(level.name, counts[j], tuples[k][1] * counts[j], tuples[k][0]);
+    }
+  }
+#endif
+}
+
+void check_float_samples(void) {
+#ifdef X86_KERNELS
+  static const LEVEL level = {"float_samples_sse2", "sse2", float_samples_sse2};
+  static const float specials[] = {0.0f, 1.0f, -0.0f, -1.0f, 2.0f, 0.5f, 1e30f, -1e30f, 1.0f / 510, 0.99999f};
+  static const int maxes[] = {1, 100, 255, 256, 1000, 65535};
+  unsigned int bits;
+  float value;
+  int i, j, k, little, count;
+  if (!supported(&level)) return;
+  for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+    count = (counts[j] < ROOM / 4) ? counts[j] : ROOM / 4;
+    for (k = 0; k < (int) (sizeof(maxes) / sizeof(maxes[0])); k++) {
+      for (little = 0; little <= 1; little++) {
+        for (i = 0; i < count; i++) {                                     /* Floats around 0 to 1, with values outside it, infinities and NaN */
+          value = (i % 11 < (int) (sizeof(specials) / sizeof(specials[0]))) ? specials[i % 11] : (next_random() % 30000) / 20000.0f - 0.25f;
+          memcpy(&bits, &value, sizeof(bits));
+          if (i % 29 == 3) bits = 0x7F800000u | (i % 2) << 31;                                                                  /* Infinities */
+          if (i % 31 == 5) bits = 0x7FC00000u;                                                                                         /* NaN */
+          input[1 + 4 * i] = little ? bits & 0xFF : bits >> 24;
+          input[2 + 4 * i] = little ? bits >> 8 & 0xFF : bits >> 16 & 0xFF;
+          input[3 + 4 * i] = little ? bits >> 16 & 0xFF : bits >> 8 & 0xFF;
+          input[4 + 4 * i] = little ? bits >> 24 : bits & 0xFF;
+        }
+        clear();
+        float_samples_scalar(input + 1, expected, count, maxes[k], little);
+        float_samples_sse2(input + 1, actual, count, maxes[k], little);
+        compare(level.name, count, ((maxes[k] > 255) ? 2 : 1) * count, maxes[k]);
+      }
+    }
+  }
+#endif
+}
+
+void check_sample_floats(void) {
+#ifdef X86_KERNELS
+  static const LEVEL level = {"sample_floats_sse2", "sse2", sample_floats_sse2};
+  static const int maxes[] = {1, 100, 255, 256, 1000, 65535};
+  int j, k, count;
+  if (!supported(&level)) return;
+  for (j = 0; j < (int) (sizeof(counts) / sizeof(counts[0])); j++) {
+    count = (counts[j] < ROOM / 4) ? counts[j] : ROOM / 4;
+    for (k = 0; k < (int) (sizeof(maxes) / sizeof(maxes[0])); k++) {
+      fill(input + 1, count, maxes[k], maxes[k] > 255);
+      clear();
+      sample_floats_scalar(input + 1, expected, count, maxes[k]);
+      sample_floats_sse2(input + 1, actual, count, maxes[k]);
+      compare(level.name, count, 4 * count, maxes[k]);
+    }
+  }
+#endif
+}
+
+unsigned char *generate(char magic, int width, int height, int max, int over, long *length) {
+  int samples = (depth(magic) == 3) ? 3 : 1, size = (max > 255) ? 2 : 1, limit, sample, h, w;
+  unsigned char *image = malloc(64 + 7 * (long) samples * width * height), *cursor;                     /* ASCII samples take at most 6 bytes */
+  if (image == NULL) return NULL;
+  if (depth(magic) == 1) cursor = image + sprintf((char *) image, "P%c\n%d %d\n", magic, width, height);
+  else cursor = image + sprintf((char *) image, "P%c\n%d %d\n%d\n", magic, width, height, max);
+  limit = (depth(magic) == 1) ? 1 : over ? ((size == 2) ? 65535 : 255) : max;                                   /* The largest sample written */
+  if (magic == '4') {                                                                                  /* P4 packs 8 pixels in a byte, padded */
+    for (h = 0; h < height * ((width + 7) / 8); h++) *cursor++ = next_random() >> 24;
+  }
+  else {
+    for (h = 0; h < height; h++) {
+      for (w = 0; w < samples * width; w++) {
+        sample = (int) (next_random() % (limit + 1));
+        if (magic >= '4' && size == 2) *cursor++ = sample >> 8;                                            /* The most significant byte first */
+        if (magic >= '4') *cursor++ = sample & 0xFF;
+        else cursor += sprintf((char *) cursor, (w == samples * width - 1) ? "%d\n" : "%d ", sample);
+      }
+    }
+  }
+  *length = cursor - image;
+  return image;
+}
+
+int convert_steps(const unsigned char *image, long length, char magic, char target, unsigned char **output, long *output_length) {
+  unsigned char *step = NULL;
+  int status = NETPBM_OK, bonus;
+  *output = NULL;
+  while (status == NETPBM_OK && magic != target) {
+    bonus = depth(magic) == depth(target);                                             /* Standard cases drop colors first, then a bonus case */
+    magic = !bonus ? magic - 1 : (magic <= '3') ? magic + 3 : magic - 3;                                              /* changes the encoding */
+    status = netpbm_convert_alloc((step != NULL) ? step : image, (step != NULL) ? *output_length : length, output, output_length, bonus);
+    free(step);
+    step = *output;
+  }
+  return status;
+}
+
+void check_chains(void) {
+  static const int maxes[] = {1, 3, 100, 255, 256, 1000, 65535};
+  unsigned char *image, *direct, *chain;
+  long length, direct_length, chain_length;
+  char magic, target;
+  int i, k, over, direct_status, chain_status;
+  for (i = 0; i < 24; i++) {                                                                 /* Random sizes, with odd widths for the padding */
+    for (magic = '1'; magic <= '6'; magic++) {
+      for (k = 0; k < (int) (sizeof(maxes) / sizeof(maxes[0])); k++) {
+        for (over = 0; over <= (magic == '5'); over++) {            /* P5 -> P4 takes samples above max as they are, so -t must take them too */
+          if (depth(magic) == 1 && k > 0) break;
+          image = generate(magic, 1 + next_random() % 37, 1 + next_random() % 9, maxes[k], over, &length);
+          if (image == NULL) {
+            printf("check_chains: no memory for the images\n");
+            failures++;
+            return;
+          }
+          for (target = '1'; target <= '6'; target++) {
+            if (target == magic || depth(target) > depth(magic)) continue;
+            direct_status = netpbm_convert_alloc(image, length, &direct, &direct_length, NETPBM_TO(target - '0'));
+            chain_status = convert_steps(image, length, magic, target, &chain, &chain_length);
+            checks++;
+            if (direct_status != chain_status || (direct_status == NETPBM_OK && (direct_length != chain_length
+                                                                                 || memcmp(direct, chain, direct_length) != 0))) {
+              failures++;
+              printf("P%c -> P%c of max %d%s: -t gives %d but the chain %d, or other bytes\n", magic, target, maxes[k],
+                     over ? " with samples above it" : "", direct_status, chain_status);
+            }
+            free(direct);
+            free(chain);
+          }
+          free(image);
+        }
+      }
+    }
+  }
+}
+
+void collect(void *context, const unsigned char *bytes, long count) {
+  BLOCK *block = context;
+  unsigned char *grown;
+  if (block->length + count > block->room) {
+    grown = realloc(block->bytes, 2 * (block->length + count));
+    if (grown == NULL) return;                                                          /* The comparison fails then, since bytes are missing */
+    block->bytes = grown;
+    block->room = 2 * (block->length + count);
+  }
+  memcpy(block->bytes + block->length, bytes, count);
+  block->length += count;
+}
+
+void check_frames(void) {
+  static const int maxes[] = {1, 100, 255, 1000, 65535};
+  BLOCK frames, alone, streamed;
+  NETPBM_STREAM *stream;
+  unsigned char *image, *output;
+  long length, output_length, at, chunk;
+  char magic;
+  int bonus, i, k, frame, status;
+  for (i = 0; i < 16; i++) {
+    for (magic = '1'; magic <= '6'; magic++) {
+      for (bonus = 0; bonus <= 1; bonus++) {
+        if (!bonus && depth(magic) == 1) continue;                                                        /* BnW images have no standard case */
+        memset(&frames, 0, sizeof(frames));
+        memset(&alone, 0, sizeof(alone));
+        memset(&streamed, 0, sizeof(streamed));
+        status = NETPBM_OK;
+        for (frame = 0; frame < 3; frame++) {                                         /* Each image on its own, with nothing after its raster */
+          k = next_random() % (sizeof(maxes) / sizeof(maxes[0]));
+          image = generate(magic, 1 + next_random() % 19, 1 + next_random() % 5, maxes[k], 0, &length);
+          if (image == NULL) break;
+          if (magic <= '3') length--;                                                        /* The new line after the last sample is dropped */
+          collect(&frames, image, length);
+          if (netpbm_convert_alloc(image, length, &output, &output_length, bonus) != NETPBM_OK) status = NETPBM_ERROR;
+          collect(&alone, output, output_length);
+          free(output);
+          free(image);
+        }
+        stream = netpbm_stream_open(bonus, collect, &streamed);
+        for (at = 0; stream != NULL && at < frames.length; at += chunk) {                        /* Chunks of a few bytes, that split numbers */
+          chunk = 1 + next_random() % 7;
+          netpbm_stream_feed(stream, frames.bytes + at, (chunk < frames.length - at) ? chunk : frames.length - at);
+        }
+        if (stream == NULL || netpbm_stream_close(stream) != NETPBM_OK) status = NETPBM_ERROR;
+        checks++;
+        if (status != NETPBM_OK || frame < 3 || streamed.length != alone.length || memcmp(streamed.bytes, alone.bytes, alone.length) != 0) {
+          failures++;
+          printf("%s of 3 images in P%c without white space between them: the stream differs from each image alone\n",
+                 bonus ? "bonus" : "standard", magic);
+        }
+        free(frames.bytes);
+        free(alone.bytes);
+        free(streamed.bytes);
+      }
+    }
+  }
+}
+
+void check_floats(void) {
+  static const int sizes[][2] = {{1, 1}, {7, 5}, {33, 1000}, {11, 4000}, {12000, 3}, {0, 4}, {5, 0}};                     /* Width and height */
+  static const int modes[] = {0, 1, NETPBM_TO(4), NETPBM_TO(5), NETPBM_TO(7), NETPBM_TO_PFM_GRAY};
+  static const char *standard[] = {"Pf\n", "P4\n"};                                             /* PF steps down to Pf, and Pf to P4, like P6 */
+  BLOCK streamed;
+  NETPBM_STREAM *stream;
+  unsigned char *image, *output;
+  long length, output_length, at, i;
+  float value;
+  int color, k, m, truncated, status;
+  for (color = 0; color <= 1; color++) {
+    for (k = 0; k < (int) (sizeof(sizes) / sizeof(sizes[0])); k++) {
+      for (truncated = 0; truncated <= 1; truncated++) {
+        length = 4 * (long) (color ? 3 : 1) * sizes[k][0] * sizes[k][1];
+        image = malloc(32 + length);
+        if (image == NULL) {
+          printf("check_floats: no memory for the images\n");
+          failures++;
+          return;
+        }
+        at = sprintf((char *) image, "P%c\n%d %d\n%s\n", color ? 'F' : 'f', sizes[k][0], sizes[k][1], (k % 2) ? "1.0" : "-1.0");
+        for (i = 0; i < length; i += 4) {                                                  /* Floats from 0 to 1, and a few out of that range */
+          value = (next_random() % 1100) / 1000.0f - 0.05f;
+          memcpy(image + at + i, &value, 4);                                                   /* The byte order of the scale does not matter */
+        }
+        length += at - truncated * 7;
+        for (m = 0; m < (int) (sizeof(modes) / sizeof(modes[0])); m++) {
+          memset(&streamed, 0, sizeof(streamed));
+          status = netpbm_convert_alloc(image, length, &output, &output_length, modes[m]);
+          stream = netpbm_stream_open(modes[m], collect, &streamed);                                       /* A stream keeps the whole raster */
+          for (at = 0; stream != NULL && at < length; at += 4096) {
+            netpbm_stream_feed(stream, image + at, (length - at < 4096) ? length - at : 4096);
+          }
+          checks++;
+          if (stream == NULL || netpbm_stream_close(stream) != status || streamed.length != output_length
+              || memcmp(streamed.bytes, output, output_length) != 0) {
+            failures++;
+            printf("P%c of %dx%d%s in mode %d: the image in memory differs from the stream\n", color ? 'F' : 'f', sizes[k][0], sizes[k][1],
+                   truncated ? ", truncated," : "", modes[m]);
+          }
+          else if (modes[m] == 0 && !truncated && strncmp((char *) output, standard[!color], 3) != 0) {
+            failures++;
+            printf("P%c gives %.2s in the standard case, instead of %.2s\n", color ? 'F' : 'f', (char *) output, standard[!color]);
+          }
+          free(output);
+          free(streamed.bytes);
+        }
+        free(image);
+      }
+    }
+  }
+}
+
+void check_stream_limit(void) {
+  static NETPBM_STREAM *streams[NETPBM_MAX_STREAMS + 1];
+  BLOCK output;
+  int i, opened;
+  memset(&output, 0, sizeof(output));
+  for (opened = 0; opened <= NETPBM_MAX_STREAMS && (streams[opened] = netpbm_stream_open(0, collect, &output)) != NULL; opened++);
+  checks++;
+  if (opened != NETPBM_MAX_STREAMS) {
+    failures++;
+    printf("%d streams were opened at once, instead of %d\n", opened, NETPBM_MAX_STREAMS);
+  }
+  if (opened > 0) {
+    netpbm_stream_close(streams[--opened]);
+    streams[opened] = netpbm_stream_open(0, collect, &output);                                    /* A stream that is closed makes room again */
+    checks++;
+    if (streams[opened] == NULL) {
+      failures++;
+      printf("no stream could be opened after one was closed\n");
+    }
+    else opened++;
+  }
+  for (i = 0; i < opened; i++) netpbm_stream_close(streams[i]);
+  free(output.bytes);
+}